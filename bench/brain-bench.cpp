@@ -0,0 +1,378 @@
+/*
+brain-bench: runs a prompt corpus through the plugin's inference scheduler without OBS or Qt
+and reports prefill speed, time to first token, decode speed, per-token latency and peak RSS
+as JSON.
+*/
+
+#include "llama-inference.h"
+#include "inference-scheduler.h"
+#include "llm-config-data.h"
+#include "plugin-support.h"
+
+#include <obs-module.h>
+#include <util/base.h>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+llm_config_data global_llm_config;
+llm_global_context global_llm_context;
+
+// the settings are set once before the model is loaded and never change
+static std::shared_ptr<const llm_config_data> published_config;
+
+void llm_config_publish()
+{
+	published_config = std::make_shared<const llm_config_data>(global_llm_config);
+}
+
+std::shared_ptr<const llm_config_data> llm_config_snapshot()
+{
+	return published_config;
+}
+
+struct bench_options {
+	std::string model_path;
+	std::string prompts_path;
+	std::string output_path;
+	std::string system_prompt = "{0}";
+	int n_predict = 64;
+	int n_parallel = 1;
+	int n_ctx = 512;
+	int n_batch = 512;
+	int n_threads = 0;
+	int n_threads_batch = 0;
+	int repeat = 1;
+	float temperature = 0.0f;
+	bool verbose = false;
+};
+
+// timings of one request, all times from ggml_time_us
+struct request_metrics {
+	int64_t t_submit_us = 0;
+	int64_t t_done_us = 0;
+	int n_prompt = 0;
+	float prefill_tokens_per_second = 0.0f;
+	std::vector<int64_t> t_tokens_us;
+};
+
+static bool verbose_log = false;
+
+static void log_handler(int log_level, const char *format, va_list args, void *)
+{
+	if (log_level > LOG_WARNING && !verbose_log) {
+		return;
+	}
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+}
+
+static void print_usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s -m model.gguf [options]\n"
+		"  -m, --model PATH       GGUF model to load\n"
+		"  -f, --prompts PATH     prompt corpus, one prompt per line (default: built-in)\n"
+		"  -o, --output PATH      write the JSON report to PATH instead of stdout\n"
+		"  -s, --system TEXT      prompt template, {0} is replaced by the prompt\n"
+		"  -n, --n-predict N      tokens to generate per prompt (default: 64)\n"
+		"  -p, --parallel N       requests decoded together (default: 1)\n"
+		"  -c, --ctx N            context length per request (default: 512)\n"
+		"  -b, --batch N          batch size (default: 512)\n"
+		"  -t, --threads N        generation threads (default: llama.cpp default)\n"
+		"      --threads-batch N  prompt processing threads (default: --threads)\n"
+		"  -r, --repeat N         run the corpus N times (default: 1)\n"
+		"      --temp T           sampling temperature (default: 0, greedy)\n"
+		"  -v, --verbose          print the plugin log\n",
+		argv0);
+}
+
+static bool parse_args(int argc, char **argv, bench_options &options)
+{
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const auto value = [&]() -> const char * {
+			return i + 1 < argc ? argv[++i] : nullptr;
+		};
+		const char *v = nullptr;
+		if (arg == "-v" || arg == "--verbose") {
+			options.verbose = true;
+			continue;
+		}
+		if (arg == "-h" || arg == "--help" || (v = value()) == nullptr) {
+			return false;
+		}
+		if (arg == "-m" || arg == "--model") {
+			options.model_path = v;
+		} else if (arg == "-f" || arg == "--prompts") {
+			options.prompts_path = v;
+		} else if (arg == "-o" || arg == "--output") {
+			options.output_path = v;
+		} else if (arg == "-s" || arg == "--system") {
+			options.system_prompt = v;
+		} else if (arg == "-n" || arg == "--n-predict") {
+			options.n_predict = std::max(atoi(v), 1);
+		} else if (arg == "-p" || arg == "--parallel") {
+			options.n_parallel = std::max(atoi(v), 1);
+		} else if (arg == "-c" || arg == "--ctx") {
+			options.n_ctx = std::max(atoi(v), 64);
+		} else if (arg == "-b" || arg == "--batch") {
+			options.n_batch = std::max(atoi(v), 1);
+		} else if (arg == "-t" || arg == "--threads") {
+			options.n_threads = std::max(atoi(v), 0);
+		} else if (arg == "--threads-batch") {
+			options.n_threads_batch = std::max(atoi(v), 0);
+		} else if (arg == "-r" || arg == "--repeat") {
+			options.repeat = std::max(atoi(v), 1);
+		} else if (arg == "--temp") {
+			options.temperature = (float)atof(v);
+		} else {
+			return false;
+		}
+	}
+	return !options.model_path.empty();
+}
+
+static std::vector<std::string> load_prompts(const std::string &path)
+{
+	if (path.empty()) {
+		return {
+			"Write a short welcome message for viewers joining a live stream.",
+			"Summarize in one sentence: the match went to overtime and the home team "
+			"won on a late goal after trailing for most of the second half.",
+			"Suggest three titles for a cooking stream about homemade pasta.",
+			"Translate to French: thanks for following, see you tomorrow.",
+		};
+	}
+	std::vector<std::string> prompts;
+	std::ifstream file(path);
+	std::string line;
+	while (std::getline(file, line)) {
+		if (!line.empty()) {
+			prompts.push_back(line);
+		}
+	}
+	return prompts;
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+	if (values.empty()) {
+		return 0.0;
+	}
+	std::sort(values.begin(), values.end());
+	const size_t index = (size_t)(p / 100.0 * (double)(values.size() - 1) + 0.5);
+	return values[std::min(index, values.size() - 1)];
+}
+
+static double mean(const std::vector<double> &values)
+{
+	double sum = 0.0;
+	for (double v : values) {
+		sum += v;
+	}
+	return values.empty() ? 0.0 : sum / (double)values.size();
+}
+
+static int64_t peak_rss_bytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (int64_t)counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return (int64_t)usage.ru_maxrss;
+#else
+	return (int64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	bench_options options;
+	if (!parse_args(argc, argv, options)) {
+		print_usage(argv[0]);
+		return 1;
+	}
+	verbose_log = options.verbose;
+	base_set_log_handler(log_handler, nullptr);
+
+	const std::vector<std::string> prompts = load_prompts(options.prompts_path);
+	if (prompts.empty()) {
+		fprintf(stderr, "no prompts in %s\n", options.prompts_path.c_str());
+		return 1;
+	}
+
+	// the defaults of a new install with the benchmark parameters, and no stop strings so
+	// every token is reported
+	config_defaults();
+	global_llm_config.local_model_path = options.model_path;
+	global_llm_config.system_prompt = options.system_prompt;
+	global_llm_config.temperature = options.temperature;
+	// the token callback stops a request after n_predict tokens
+	global_llm_config.max_output_tokens = 0;
+	global_llm_config.n_parallel = options.n_parallel;
+	global_llm_config.n_ctx = options.n_ctx;
+	global_llm_config.n_batch = options.n_batch;
+	global_llm_config.n_threads = options.n_threads;
+	global_llm_config.n_threads_batch = options.n_threads_batch;
+	llm_config_publish();
+
+	const int64_t t_load_start_us = ggml_time_us();
+	struct llama_model *model = llama_load_model(options.model_path, global_llm_config);
+	struct llama_context *ctx =
+		model != nullptr ? llama_init_context(model, global_llm_config) : nullptr;
+	if (ctx == nullptr) {
+		fprintf(stderr, "failed to load %s\n", options.model_path.c_str());
+		return 1;
+	}
+	llama_warmup_context(ctx);
+	const int64_t t_load_us = ggml_time_us() - t_load_start_us;
+
+	inference_scheduler scheduler(nullptr, options.n_batch, options.n_parallel,
+				      (size_t)options.n_parallel);
+	scheduler.set_context(ctx);
+
+	std::mutex metrics_mutex;
+	std::vector<request_metrics> metrics(prompts.size() * options.repeat);
+	std::vector<std::future<std::string>> pending;
+
+	const int64_t t_start_us = ggml_time_us();
+	for (size_t i = 0; i < metrics.size(); i++) {
+		request_metrics &m = metrics[i];
+		inference_job job;
+		job.prompt = prompts[i % prompts.size()];
+		job.priority = INFERENCE_PRIORITY_INTERACTIVE;
+		job.cancel = make_cancellation_token();
+		job.prefill_progress_callback = [&m, &metrics_mutex](int, int n_total,
+								       float tokens_per_second) {
+			std::lock_guard<std::mutex> lock(metrics_mutex);
+			m.n_prompt = n_total;
+			m.prefill_tokens_per_second = tokens_per_second;
+		};
+		cancellation_token cancel = job.cancel;
+		const int n_predict = options.n_predict;
+		job.token_callback = [&m, &metrics_mutex, cancel, n_predict](llama_token) {
+			std::lock_guard<std::mutex> lock(metrics_mutex);
+			if ((int)m.t_tokens_us.size() < n_predict) {
+				m.t_tokens_us.push_back(ggml_time_us());
+			}
+			if ((int)m.t_tokens_us.size() >= n_predict) {
+				*cancel = true;
+			}
+		};
+		job.done_callback = [&m, &metrics_mutex](const std::string &,
+							 inference_stop_reason) {
+			std::lock_guard<std::mutex> lock(metrics_mutex);
+			m.t_done_us = ggml_time_us();
+		};
+
+		// keep at most n_parallel requests in flight so the queue never drops one
+		if ((int)pending.size() >= options.n_parallel) {
+			pending.front().get();
+			pending.erase(pending.begin());
+		}
+		m.t_submit_us = ggml_time_us();
+		pending.push_back(scheduler.submit(std::move(job)));
+	}
+	for (auto &result : pending) {
+		result.get();
+	}
+	const int64_t t_total_us = ggml_time_us() - t_start_us;
+	scheduler.stop();
+
+	std::vector<double> prefill_tps, ttft_ms, decode_tps, token_latency_ms;
+	int64_t n_generated = 0;
+	nlohmann::json requests = nlohmann::json::array();
+	for (const request_metrics &m : metrics) {
+		nlohmann::json r;
+		r["prompt_tokens"] = m.n_prompt;
+		r["generated_tokens"] = m.t_tokens_us.size();
+		r["prefill_tokens_per_second"] = m.prefill_tokens_per_second;
+		if (m.prefill_tokens_per_second > 0.0f) {
+			prefill_tps.push_back(m.prefill_tokens_per_second);
+		}
+		n_generated += (int64_t)m.t_tokens_us.size();
+		if (!m.t_tokens_us.empty()) {
+			const double ttft = (m.t_tokens_us.front() - m.t_submit_us) / 1000.0;
+			ttft_ms.push_back(ttft);
+			r["ttft_ms"] = ttft;
+		}
+		if (m.t_tokens_us.size() > 1) {
+			const double t_decode_s =
+				(m.t_tokens_us.back() - m.t_tokens_us.front()) / 1000000.0;
+			const double tps = (double)(m.t_tokens_us.size() - 1) / t_decode_s;
+			decode_tps.push_back(tps);
+			r["decode_tokens_per_second"] = tps;
+			for (size_t i = 1; i < m.t_tokens_us.size(); i++) {
+				token_latency_ms.push_back(
+					(m.t_tokens_us[i] - m.t_tokens_us[i - 1]) / 1000.0);
+			}
+		}
+		requests.push_back(r);
+	}
+
+	char model_desc[128];
+	llama_model_desc(model, model_desc, sizeof(model_desc));
+
+	nlohmann::json report;
+	report["model"] = options.model_path;
+	report["model_desc"] = model_desc;
+	report["model_size_bytes"] = llama_model_size(model);
+	report["system_info"] = llama_print_system_info();
+	report["settings"] = {{"n_predict", options.n_predict},
+			      {"n_parallel", options.n_parallel},
+			      {"n_ctx", options.n_ctx},
+			      {"n_batch", options.n_batch},
+			      {"n_threads", options.n_threads},
+			      {"n_threads_batch", options.n_threads_batch},
+			      {"temperature", options.temperature},
+			      {"requests", metrics.size()}};
+	report["load_ms"] = t_load_us / 1000.0;
+	report["total_ms"] = t_total_us / 1000.0;
+	report["generated_tokens"] = n_generated;
+	report["throughput_tokens_per_second"] =
+		t_total_us > 0 ? n_generated * 1000000.0 / t_total_us : 0.0;
+	report["prefill_tokens_per_second"] = mean(prefill_tps);
+	report["ttft_ms"] = {{"mean", mean(ttft_ms)},
+			     {"p50", percentile(ttft_ms, 50)},
+			     {"p99", percentile(ttft_ms, 99)}};
+	report["decode_tokens_per_second"] = mean(decode_tps);
+	report["token_latency_ms"] = {{"p50", percentile(token_latency_ms, 50)},
+				      {"p99", percentile(token_latency_ms, 99)},
+				      {"max", percentile(token_latency_ms, 100)}};
+	report["peak_rss_bytes"] = peak_rss_bytes();
+	report["requests"] = requests;
+
+	llama_free(ctx);
+	llama_free_model(model);
+	llama_backend_free();
+
+	if (options.output_path.empty()) {
+		std::cout << report.dump(2) << std::endl;
+	} else {
+		std::ofstream(options.output_path) << report.dump(2) << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+governor-sim: replays a simulated OBS health trace through the inference governor and checks
+that it throttles at once when OBS struggles and releases the throttle step by step once OBS
+recovers. Exits with 1 if a transition differs from the expected one.
+*/
+
+#include "inference-governor.h"
+#include "llm-config-data.h"
+
+#include <cstdio>
+#include <vector>
+
+llm_config_data global_llm_config;
+llm_global_context global_llm_context;
+
+// the governor thread is not run here, the settings it reads are only linked
+void llm_config_publish() {}
+
+std::shared_ptr<const llm_config_data> llm_config_snapshot()
+{
+	return std::make_shared<const llm_config_data>(global_llm_config);
+}
+
+// 60 fps
+static const uint64_t FRAME_INTERVAL_NS = 16666667;
+
+// one second of OBS: frames rendered and encoded, of which lagged and skipped, and the average
+// frame time
+struct trace_second {
+	uint32_t n_lagged;
+	uint32_t n_skipped;
+	double frame_time_ms;
+	// throttle level the governor should apply after this second
+	int expected_level;
+};
+
+static const std::vector<trace_second> trace = {
+	// calm, the first sample only sets the baseline
+	{0, 0, 4.0, 0},
+	{0, 0, 4.0, 0},
+	// a burst of lagged frames, then skipped encoder frames, then frames too slow to render
+	{6, 0, 4.0, 1},
+	{0, 3, 4.0, 2},
+	{0, 0, 15.0, 3},
+	// busy without dropping frames holds the level
+	{0, 0, 10.0, 3},
+	{0, 0, 15.0, 3},
+	// recovered: one level less after five healthy seconds each
+	{0, 0, 4.0, 3},
+	{0, 0, 4.0, 3},
+	{0, 0, 4.0, 3},
+	{0, 0, 4.0, 3},
+	{0, 0, 4.0, 2},
+	// busy but not struggling restarts the count
+	{0, 0, 10.0, 2},
+	{0, 0, 4.0, 2},
+	{0, 0, 4.0, 2},
+	{0, 0, 4.0, 2},
+	{0, 0, 4.0, 2},
+	{0, 0, 4.0, 1},
+	{0, 0, 4.0, 1},
+	{0, 0, 4.0, 1},
+	{0, 0, 4.0, 1},
+	{0, 0, 4.0, 1},
+	{0, 0, 4.0, 0},
+};
+
+// cumulative counters, as libobs reports them
+static std::vector<obs_health_sample> trace_samples()
+{
+	std::vector<obs_health_sample> samples;
+	obs_health_sample sample;
+	sample.frame_interval_ns = FRAME_INTERVAL_NS;
+	for (const trace_second &second : trace) {
+		sample.total_frames += 60;
+		sample.encoded_frames += 60;
+		sample.lagged_frames += second.n_lagged;
+		sample.skipped_frames += second.n_skipped;
+		sample.average_frame_time_ns = (uint64_t)(second.frame_time_ms * 1e6);
+		samples.push_back(sample);
+	}
+	return samples;
+}
+
+int main()
+{
+	int n_failed = 0;
+
+	// every level holds back more than the one below
+	inference_throttle previous;
+	for (int level = 1; level <= 3; level++) {
+		const inference_throttle throttle = inference_governor::throttle_for_level(level);
+		const bool stronger =
+			throttle.defer_background &&
+			throttle.step_pause_ms >= previous.step_pause_ms &&
+			(previous.max_batch_tokens == 0 ||
+			 (throttle.max_batch_tokens > 0 &&
+			  throttle.max_batch_tokens <= previous.max_batch_tokens));
+		printf("level %d: defer %d, pause %d ms, max. batch %d%s\n", level,
+		       throttle.defer_background, throttle.step_pause_ms, throttle.max_batch_tokens,
+		       stronger ? "" : "  FAILED: not stronger than the level below");
+		n_failed += stronger ? 0 : 1;
+		previous = throttle;
+	}
+	if (inference_governor::throttle_for_level(0).defer_background ||
+	    inference_governor::throttle_for_level(0).step_pause_ms != 0) {
+		printf("level 0 FAILED: holds something back\n");
+		n_failed++;
+	}
+
+	inference_governor governor;
+	obs_health_source source = obs_health_source_simulated(trace_samples());
+	for (size_t i = 0; i < trace.size(); i++) {
+		obs_health_sample sample;
+		if (!source(sample)) {
+			printf("no sample\n");
+			return 1;
+		}
+		const int level = governor.update(sample).level;
+		const bool ok = level == trace[i].expected_level;
+		printf("%2zu s: lagged %u, skipped %u, frame time %.1f ms -> level %d%s\n", i,
+		       trace[i].n_lagged, trace[i].n_skipped, trace[i].frame_time_ms, level,
+		       ok ? "" : "  FAILED");
+		if (!ok) {
+			printf("      expected level %d\n", trace[i].expected_level);
+			n_failed++;
+		}
+	}
+
+	printf("%s\n", n_failed == 0 ? "all transitions as expected" : "transitions FAILED");
+	return n_failed == 0 ? 0 : 1;
+}
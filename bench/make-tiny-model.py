@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""Write a tiny llama-architecture GGUF with random weights for brain-bench runs in CI.
+
+The model produces nonsense but exercises the full load, tokenize, prefill and decode path in
+milliseconds. Only the standard library is used, so CI needs no extra packages.
+
+usage: make-tiny-model.py OUTPUT.gguf [--seed N]
+"""
+
+import argparse
+import random
+import struct
+from array import array
+
+GGUF_MAGIC = 0x46554747
+GGUF_VERSION = 3
+ALIGNMENT = 32
+
+# gguf metadata value types
+T_UINT32 = 4
+T_INT32 = 5
+T_FLOAT32 = 6
+T_STRING = 8
+T_ARRAY = 9
+
+GGML_TYPE_F32 = 0
+
+# llama.cpp token types
+TOKEN_NORMAL = 1
+TOKEN_UNKNOWN = 2
+TOKEN_CONTROL = 3
+TOKEN_BYTE = 6
+
+N_EMBD = 64
+N_HEAD = 4
+N_HEAD_KV = 2
+N_FF = 128
+N_LAYER = 2
+N_CTX_TRAIN = 2048
+
+
+def vocabulary():
+    """SentencePiece style vocabulary: specials, byte fallback, printable characters and a few
+    merges so tokenization does more than byte fallback."""
+    tokens = [("<unk>", TOKEN_UNKNOWN), ("<s>", TOKEN_CONTROL), ("</s>", TOKEN_CONTROL)]
+    tokens += [("<0x%02X>" % b, TOKEN_BYTE) for b in range(256)]
+    pieces = ["▁"] + [chr(c) for c in range(33, 127)]
+    for word in ["the", "and", "to", "of", "in", "you", "for", "stream", "on", "is"]:
+        pieces += ["▁" + word[:i] for i in range(1, len(word) + 1)]
+        pieces += [word[:i] for i in range(2, len(word) + 1)]
+    seen = set()
+    for piece in pieces:
+        if piece not in seen:
+            seen.add(piece)
+            tokens.append((piece, TOKEN_NORMAL))
+    return tokens
+
+
+def pack_string(s):
+    data = s.encode("utf-8")
+    return struct.pack("<Q", len(data)) + data
+
+
+def pack_kv(key, value_type, value, array_type=None):
+    out = pack_string(key) + struct.pack("<I", value_type)
+    if value_type == T_UINT32:
+        out += struct.pack("<I", value)
+    elif value_type == T_FLOAT32:
+        out += struct.pack("<f", value)
+    elif value_type == T_STRING:
+        out += pack_string(value)
+    elif value_type == T_ARRAY:
+        out += struct.pack("<IQ", array_type, len(value))
+        for item in value:
+            if array_type == T_STRING:
+                out += pack_string(item)
+            elif array_type == T_FLOAT32:
+                out += struct.pack("<f", item)
+            elif array_type == T_INT32:
+                out += struct.pack("<i", item)
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("output")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    rng = random.Random(args.seed)
+
+    tokens = vocabulary()
+    n_vocab = len(tokens)
+    n_embd_kv = N_EMBD // N_HEAD * N_HEAD_KV
+
+    kv = [
+        pack_kv("general.architecture", T_STRING, "llama"),
+        pack_kv("general.name", T_STRING, "brain-bench-tiny"),
+        pack_kv("general.alignment", T_UINT32, ALIGNMENT),
+        pack_kv("llama.context_length", T_UINT32, N_CTX_TRAIN),
+        pack_kv("llama.embedding_length", T_UINT32, N_EMBD),
+        pack_kv("llama.feed_forward_length", T_UINT32, N_FF),
+        pack_kv("llama.block_count", T_UINT32, N_LAYER),
+        pack_kv("llama.attention.head_count", T_UINT32, N_HEAD),
+        pack_kv("llama.attention.head_count_kv", T_UINT32, N_HEAD_KV),
+        pack_kv("llama.rope.dimension_count", T_UINT32, N_EMBD // N_HEAD),
+        pack_kv("llama.attention.layer_norm_rms_epsilon", T_FLOAT32, 1e-5),
+        pack_kv("tokenizer.ggml.model", T_STRING, "llama"),
+        pack_kv("tokenizer.ggml.tokens", T_ARRAY, [t for t, _ in tokens], T_STRING),
+        pack_kv("tokenizer.ggml.scores", T_ARRAY, [-float(i) for i in range(n_vocab)],
+                T_FLOAT32),
+        pack_kv("tokenizer.ggml.token_type", T_ARRAY, [t for _, t in tokens], T_INT32),
+        pack_kv("tokenizer.ggml.unknown_token_id", T_UINT32, 0),
+        pack_kv("tokenizer.ggml.bos_token_id", T_UINT32, 1),
+        pack_kv("tokenizer.ggml.eos_token_id", T_UINT32, 2),
+    ]
+
+    # tensor name and ggml dimensions (ne[0] first)
+    tensors = [("token_embd.weight", (N_EMBD, n_vocab)), ("output_norm.weight", (N_EMBD,)),
+               ("output.weight", (N_EMBD, n_vocab))]
+    for i in range(N_LAYER):
+        tensors += [
+            ("blk.%d.attn_norm.weight" % i, (N_EMBD,)),
+            ("blk.%d.attn_q.weight" % i, (N_EMBD, N_EMBD)),
+            ("blk.%d.attn_k.weight" % i, (N_EMBD, n_embd_kv)),
+            ("blk.%d.attn_v.weight" % i, (N_EMBD, n_embd_kv)),
+            ("blk.%d.attn_output.weight" % i, (N_EMBD, N_EMBD)),
+            ("blk.%d.ffn_norm.weight" % i, (N_EMBD,)),
+            ("blk.%d.ffn_gate.weight" % i, (N_EMBD, N_FF)),
+            ("blk.%d.ffn_down.weight" % i, (N_FF, N_EMBD)),
+            ("blk.%d.ffn_up.weight" % i, (N_EMBD, N_FF)),
+        ]
+
+    infos = b""
+    data = []
+    offset = 0
+    for name, dims in tensors:
+        n = 1
+        for d in dims:
+            n *= d
+        if name.endswith("norm.weight"):
+            values = array("f", [1.0] * n)
+        else:
+            values = array("f", [rng.gauss(0.0, 0.02) for _ in range(n)])
+        infos += pack_string(name) + struct.pack("<I", len(dims))
+        infos += struct.pack("<%dQ" % len(dims), *dims)
+        infos += struct.pack("<IQ", GGML_TYPE_F32, offset)
+        data.append(values)
+        size = n * 4
+        offset += (size + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+    with open(args.output, "wb") as f:
+        f.write(struct.pack("<IIQQ", GGUF_MAGIC, GGUF_VERSION, len(tensors), len(kv)))
+        for entry in kv:
+            f.write(entry)
+        f.write(infos)
+        f.write(b"\0" * (-f.tell() % ALIGNMENT))
+        for values in data:
+            if struct.pack("=I", 1) != struct.pack("<I", 1):
+                values.byteswap()
+            f.write(values.tobytes())
+            f.write(b"\0" * (-f.tell() % ALIGNMENT))
+
+    print("wrote %s: %d tokens, %d tensors" % (args.output, n_vocab, len(tensors)))
+
+
+if __name__ == "__main__":
+    main()
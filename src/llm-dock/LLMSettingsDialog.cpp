@@ -2,6 +2,8 @@
 
 #include "llama-inference.h"
 #include "llm-config-data.h"
+#include "model-loader.h"
+#include "response-cache.h"
 #include "plugin-support.h"
 
 #include "LLMSettingsDialog.hpp"
@@ -9,6 +11,28 @@
 
 #include <obs-module.h>
 
+// stop strings are edited one per line, with \n and \t escapes for control characters
+static QString escape_stop_string(const std::string &stop)
+{
+	QString text = QString::fromStdString(stop);
+	text.replace("\\", "\\\\").replace("\n", "\\n").replace("\t", "\\t");
+	return text;
+}
+
+static std::string unescape_stop_string(const QString &text)
+{
+	QString stop;
+	for (int i = 0; i < text.size(); i++) {
+		if (text[i] == '\\' && i + 1 < text.size()) {
+			const QChar next = text[++i];
+			stop += next == 'n' ? QChar('\n') : next == 't' ? QChar('\t') : next;
+		} else {
+			stop += text[i];
+		}
+	}
+	return stop.toStdString();
+}
+
 LLMSettingsDialog::LLMSettingsDialog(QWidget *parent) : QDialog(parent), ui(new Ui::SettingsDialog)
 {
 	ui->setupUi(this);
@@ -16,9 +40,51 @@ LLMSettingsDialog::LLMSettingsDialog(QWidget *parent) : QDialog(parent), ui(new
 	ui->sysPrompt->setPlainText(QString::fromStdString(global_llm_config.system_prompt));
 	ui->maxTokens->setText(QString::number(global_llm_config.max_output_tokens));
 	ui->temperature->setText(QString::number(global_llm_config.temperature));
+	ui->endSeq->setText(QString::fromStdString(global_llm_config.end_sequence));
+	ui->chatTurnTemplate->setText(QString::fromStdString(global_llm_config.chat_turn_template));
+	QStringList stop_strings;
+	for (const std::string &stop : global_llm_config.stop_sequences) {
+		stop_strings << escape_stop_string(stop);
+	}
+	ui->stopStrings->setPlainText(stop_strings.join("\n"));
+	ui->topK->setText(QString::number(global_llm_config.top_k));
+	ui->topP->setText(QString::number(global_llm_config.top_p));
+	ui->repeatPenalty->setText(QString::number(global_llm_config.repeat_penalty));
+	ui->prefixCache->setChecked(global_llm_config.prefix_cache);
+	ui->sessionCache->setChecked(global_llm_config.session_cache);
+	ui->workflowMaxConcurrency->setText(
+		QString::number(global_llm_config.workflow_max_concurrency));
+	ui->workflowInputMaxBytes->setText(
+		QString::number(global_llm_config.workflow_input_max_bytes));
+	ui->workflowFileSync->setCurrentIndex(global_llm_config.workflow_file_sync);
+	ui->responseCache->setChecked(global_llm_config.response_cache);
+	ui->responseCacheMb->setText(QString::number(global_llm_config.response_cache_mb));
+	ui->responseCacheDisk->setChecked(global_llm_config.response_cache_disk);
 	ui->apiKey->setText(QString::fromStdString(global_llm_config.cloud_api_key));
 	ui->apiModel->setText(QString::fromStdString(global_llm_config.cloud_model_name));
 	ui->localLlmPath->setText(QString::fromStdString(global_llm_config.local_model_path));
+	ui->contextShift->setChecked(global_llm_config.context_shift);
+	ui->draftModelPath->setText(QString::fromStdString(global_llm_config.draft_model_path));
+	ui->nDraft->setText(QString::number(global_llm_config.n_draft));
+	ui->nParallel->setText(QString::number(global_llm_config.n_parallel));
+	ui->backgroundContext->setChecked(global_llm_config.background_context);
+	ui->backgroundNCtx->setText(QString::number(global_llm_config.background_n_ctx));
+	ui->backgroundNThreads->setText(QString::number(global_llm_config.background_n_threads));
+	ui->idleUnloadMinutes->setText(QString::number(global_llm_config.idle_unload_minutes));
+	ui->idleUnloadModel->setChecked(global_llm_config.idle_unload_model);
+	ui->nCtx->setText(QString::number(global_llm_config.n_ctx));
+	ui->kvCacheType->setCurrentIndex(global_llm_config.kv_cache_type);
+	ui->useMmap->setChecked(global_llm_config.use_mmap);
+	ui->useMlock->setChecked(global_llm_config.use_mlock);
+	ui->memoryBudgetMb->setText(QString::number(global_llm_config.memory_budget_mb));
+	ui->inferenceGovernor->setChecked(global_llm_config.inference_governor);
+	ui->nBatch->setText(QString::number(global_llm_config.n_batch));
+	ui->nThreads->setText(QString::number(global_llm_config.n_threads));
+	ui->nThreadsBatch->setText(QString::number(global_llm_config.n_threads_batch));
+	ui->cpuAffinity->setText(QString::fromStdString(global_llm_config.cpu_affinity));
+	ui->lowPriority->setChecked(global_llm_config.low_priority);
+	ui->autoTuneThreads->setChecked(global_llm_config.auto_tune_threads);
+	ui->metricsLog->setChecked(global_llm_config.metrics_log);
 	ui->dockLLM->setCurrentIndex(global_llm_config.local ? 0 : 1);
 
 	// File dialog
@@ -29,18 +95,82 @@ LLMSettingsDialog::LLMSettingsDialog(QWidget *parent) : QDialog(parent), ui(new
 			this->ui->localLlmPath->setText(fileName);
 		}
 	});
+	connect(this->ui->draftModelPathButton, &QPushButton::clicked, this, [=]() {
+		QString fileName = QFileDialog::getOpenFileName(this, tr("Open File"), "",
+								tr("Model Files (*.gguf)"));
+		if (fileName != "") {
+			this->ui->draftModelPath->setText(fileName);
+		}
+	});
 
 	// connect to the dialog Save action to save the settings
 	this->connect(this->ui->buttonBox, &QDialogButtonBox::accepted, this, [=]() {
+		// the local model is reloaded when it or its context settings change
+		const llm_config_data previous_config = global_llm_config;
+
 		// get settings from UI into config struct
 		global_llm_config.local = this->ui->dockLLM->currentIndex() == 0;
 		global_llm_config.local_model_path = this->ui->localLlmPath->text().toStdString();
+		global_llm_config.context_shift = this->ui->contextShift->isChecked();
+		global_llm_config.draft_model_path =
+			this->ui->draftModelPath->text().toStdString();
+		global_llm_config.n_draft = std::max(this->ui->nDraft->text().toInt(), 0);
+		global_llm_config.n_parallel = std::max(this->ui->nParallel->text().toInt(), 1);
+		global_llm_config.n_ctx = std::max(this->ui->nCtx->text().toInt(), 64);
+		global_llm_config.kv_cache_type = this->ui->kvCacheType->currentIndex();
+		global_llm_config.use_mmap = this->ui->useMmap->isChecked();
+		global_llm_config.use_mlock = this->ui->useMlock->isChecked();
+		global_llm_config.memory_budget_mb =
+			std::max(this->ui->memoryBudgetMb->text().toInt(), 0);
+		global_llm_config.inference_governor = this->ui->inferenceGovernor->isChecked();
+		global_llm_config.background_context = this->ui->backgroundContext->isChecked();
+		global_llm_config.background_n_ctx =
+			std::max(this->ui->backgroundNCtx->text().toInt(), 64);
+		global_llm_config.background_n_threads =
+			std::max(this->ui->backgroundNThreads->text().toInt(), 0);
+		global_llm_config.n_batch = std::max(this->ui->nBatch->text().toInt(), 1);
+		global_llm_config.n_threads = std::max(this->ui->nThreads->text().toInt(), 0);
+		global_llm_config.n_threads_batch =
+			std::max(this->ui->nThreadsBatch->text().toInt(), 0);
+		global_llm_config.cpu_affinity = this->ui->cpuAffinity->text().toStdString();
+		global_llm_config.low_priority = this->ui->lowPriority->isChecked();
+		global_llm_config.auto_tune_threads = this->ui->autoTuneThreads->isChecked();
+		global_llm_config.metrics_log = this->ui->metricsLog->isChecked();
+		global_llm_config.idle_unload_minutes =
+			std::max(this->ui->idleUnloadMinutes->text().toInt(), 0);
+		global_llm_config.idle_unload_model = this->ui->idleUnloadModel->isChecked();
 		global_llm_config.cloud_api_key = this->ui->apiKey->text().toStdString();
 		global_llm_config.cloud_model_name = this->ui->apiModel->text().toStdString();
 		global_llm_config.system_prompt = this->ui->sysPrompt->toPlainText().toStdString();
 		global_llm_config.end_sequence = this->ui->endSeq->text().toStdString();
+		global_llm_config.chat_turn_template =
+			this->ui->chatTurnTemplate->text().toStdString();
+		global_llm_config.stop_sequences.clear();
+		for (const QString &line : this->ui->stopStrings->toPlainText().split("\n")) {
+			if (!line.isEmpty()) {
+				global_llm_config.stop_sequences.push_back(
+					unescape_stop_string(line));
+			}
+		}
 		global_llm_config.max_output_tokens = this->ui->maxTokens->text().toUShort();
 		global_llm_config.temperature = this->ui->temperature->text().toFloat();
+		global_llm_config.top_k = this->ui->topK->text().toInt();
+		global_llm_config.top_p = this->ui->topP->text().toFloat();
+		global_llm_config.repeat_penalty = this->ui->repeatPenalty->text().toFloat();
+		global_llm_config.prefix_cache = this->ui->prefixCache->isChecked();
+		global_llm_config.session_cache = this->ui->sessionCache->isChecked();
+		global_llm_config.workflow_max_concurrency =
+			std::max(this->ui->workflowMaxConcurrency->text().toInt(), 1);
+		global_llm_config.workflow_input_max_bytes =
+			std::max(this->ui->workflowInputMaxBytes->text().toInt(), 1);
+		global_llm_config.workflow_file_sync = this->ui->workflowFileSync->currentIndex();
+		global_llm_config.response_cache = this->ui->responseCache->isChecked();
+		global_llm_config.response_cache_mb =
+			std::max(this->ui->responseCacheMb->text().toInt(), 0);
+		global_llm_config.response_cache_disk = this->ui->responseCacheDisk->isChecked();
+		if (!global_llm_config.response_cache) {
+			response_cache_clear();
+		}
 
 		// serialize to json and save to the OBS module settings
 		if (saveConfig() == OBS_BRAIN_CONFIG_SUCCESS) {
@@ -49,6 +179,41 @@ LLMSettingsDialog::LLMSettingsDialog(QWidget *parent) : QDialog(parent), ui(new
 			obs_log(LOG_ERROR, "Failed to save LLM settings");
 		}
 
+		if (global_llm_config.local && !global_llm_config.local_model_path.empty() &&
+		    (global_llm_config.local != previous_config.local ||
+		     global_llm_config.local_model_path != previous_config.local_model_path ||
+		     global_llm_config.draft_model_path != previous_config.draft_model_path ||
+		     global_llm_config.n_parallel != previous_config.n_parallel ||
+		     global_llm_config.n_ctx != previous_config.n_ctx ||
+		     global_llm_config.kv_cache_type != previous_config.kv_cache_type ||
+		     global_llm_config.use_mmap != previous_config.use_mmap ||
+		     global_llm_config.use_mlock != previous_config.use_mlock ||
+		     global_llm_config.memory_budget_mb != previous_config.memory_budget_mb ||
+		     global_llm_config.n_batch != previous_config.n_batch ||
+		     global_llm_config.n_threads != previous_config.n_threads ||
+		     global_llm_config.n_threads_batch != previous_config.n_threads_batch ||
+		     global_llm_config.cpu_affinity != previous_config.cpu_affinity ||
+		     global_llm_config.low_priority != previous_config.low_priority ||
+		     global_llm_config.auto_tune_threads != previous_config.auto_tune_threads ||
+		     global_llm_config.background_context != previous_config.background_context ||
+		     (global_llm_config.background_context &&
+		      (global_llm_config.background_n_ctx != previous_config.background_n_ctx ||
+		       global_llm_config.background_n_threads !=
+			       previous_config.background_n_threads ||
+		       global_llm_config.workflow_max_concurrency !=
+			       previous_config.workflow_max_concurrency)))) {
+			// loads in the background while the current model keeps serving requests
+			llm_model_load_async(global_llm_config.local_model_path);
+		} else if (global_llm_config.local && !global_llm_config.draft_model_path.empty() &&
+			   global_llm_config.temperature > 0.0f &&
+			   previous_config.temperature <= 0.0f) {
+			// the loader warns when it loads the draft model
+			obs_log(LOG_WARNING,
+				"Draft model is only used with temperature 0, unused at "
+				"temperature %.2f",
+				global_llm_config.temperature);
+		}
+
 		// close the dialog
 		this->close();
 	});
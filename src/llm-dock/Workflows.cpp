@@ -5,15 +5,51 @@
 #include "ui/ui_workflow.h"
 #include "plugin-support.h"
 #include "llm-config-data.h"
+#include "workflow-engine.h"
 
 #include <nlohmann/json.hpp>
 #include <obs-module.h>
 
+// replace the txt_srcs placeholder entry with the names of the text sources
+static void add_text_sources(QComboBox *combo)
+{
+	combo->removeItem(combo->findText("txt_srcs"));
+	obs_enum_sources(
+		[](void *data, obs_source_t *source) {
+			const char *id = obs_source_get_unversioned_id(source);
+			if (id != nullptr && strncmp(id, "text_", 5) == 0) {
+				((QComboBox *)data)->addItem(obs_source_get_name(source));
+			}
+			return true;
+		},
+		combo);
+}
+
+// select a saved entry, also a text source that is not in the current scene collection
+static void select_item(QComboBox *combo, const QString &text)
+{
+	if (!text.isEmpty() && combo->findText(text) < 0) {
+		combo->addItem(text);
+	}
+	combo->setCurrentText(text);
+}
+
 class Workflow : public QWidget {
 public:
 	Workflow(QWidget *parent = nullptr) : QWidget(parent), ui(new Ui::Workflow)
 	{
 		ui->setupUi(this);
+		add_text_sources(ui->source);
+		add_text_sources(ui->target);
+		// the path fields are only used with file input and output
+		connect(ui->source, &QComboBox::currentTextChanged, this, [=](const QString &text) {
+			ui->sourceFile->setEnabled(text == "File Input");
+			ui->sourceMode->setEnabled(text == "File Input");
+		});
+		connect(ui->target, &QComboBox::currentTextChanged, this, [=](const QString &text) {
+			ui->targetFile->setEnabled(text == "File Output");
+			ui->targetMode->setEnabled(text == "File Output");
+		});
 	}
 	~Workflow() { delete ui; }
 
@@ -32,14 +68,16 @@ Workflows::Workflows(QWidget *parent) : QDialog(parent), ui(new Ui::Workflows)
 		workflow->ui->workflowGroupBox->setTitle(
 			"Workflow " + QString::number(ui->workflowsLayout->count()));
 		workflow->ui->prompt->setPlainText(QString::fromStdString(workflowJson["prompt"]));
-		workflow->ui->source->setCurrentText(
-			QString::fromStdString(workflowJson["source"]));
+		select_item(workflow->ui->source, QString::fromStdString(workflowJson["source"]));
 		workflow->ui->sourceFile->setText(
 			QString::fromStdString(workflowJson["sourceFile"]));
-		workflow->ui->target->setCurrentText(
-			QString::fromStdString(workflowJson["target"]));
+		workflow->ui->sourceMode->setCurrentText(
+			QString::fromStdString(workflowJson.value("sourceMode", "Appended text")));
+		select_item(workflow->ui->target, QString::fromStdString(workflowJson["target"]));
 		workflow->ui->targetFile->setText(
 			QString::fromStdString(workflowJson["targetFile"]));
+		workflow->ui->targetMode->setCurrentText(
+			QString::fromStdString(workflowJson.value("targetMode", "Replace file")));
 		workflow->ui->localCloud->setCurrentText(
 			QString::fromStdString(workflowJson["localOrCloud"]));
 		workflow->ui->streaming->setChecked(workflowJson["streaming"]);
@@ -68,10 +106,14 @@ Workflows::Workflows(QWidget *parent) : QDialog(parent), ui(new Ui::Workflows)
 				workflow->ui->source->itemText(workflow->ui->source->currentIndex())
 					.toStdString();
 			workflowJson["sourceFile"] = workflow->ui->sourceFile->text().toStdString();
+			workflowJson["sourceMode"] =
+				workflow->ui->sourceMode->currentText().toStdString();
 			workflowJson["target"] =
 				workflow->ui->target->itemText(workflow->ui->target->currentIndex())
 					.toStdString();
 			workflowJson["targetFile"] = workflow->ui->targetFile->text().toStdString();
+			workflowJson["targetMode"] =
+				workflow->ui->targetMode->currentText().toStdString();
 			workflowJson["localOrCloud"] =
 				workflow->ui->localCloud
 					->itemText(workflow->ui->localCloud->currentIndex())
@@ -89,6 +131,8 @@ Workflows::Workflows(QWidget *parent) : QDialog(parent), ui(new Ui::Workflows)
 		} else {
 			obs_log(LOG_ERROR, "Failed to save LLM settings");
 		}
+		// run the saved workflows
+		workflow_engine_start();
 		// close the dialog
 		this->close();
 	});
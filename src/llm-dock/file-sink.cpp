@@ -0,0 +1,169 @@
+#include "file-sink.h"
+#include "plugin-support.h"
+
+#include <obs-module.h>
+
+#include <cstdio>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// appended text is written once this much is buffered
+static const size_t FILE_SINK_FLUSH_BYTES = 4096;
+// or at the latest this long after the first buffered write
+static const int FILE_SINK_FLUSH_MS = 250;
+
+static FILE *open_file(const std::filesystem::path &path, bool append)
+{
+#ifdef _WIN32
+	return _wfopen(path.c_str(), append ? L"ab" : L"wb");
+#else
+	return fopen(path.c_str(), append ? "ab" : "wb");
+#endif
+}
+
+static bool sync_file(FILE *file)
+{
+	if (fflush(file) != 0) {
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool sync_path(const std::filesystem::path &path)
+{
+	FILE *file = open_file(path, true);
+	if (file == nullptr) {
+		return false;
+	}
+	const bool ok = sync_file(file);
+	return fclose(file) == 0 && ok;
+}
+
+file_sink::file_sink(const std::string &path, file_sink_mode mode, file_sink_sync sync)
+	: path(path),
+	  mode(mode),
+	  sync(sync)
+{
+	thread = std::thread(&file_sink::run, this);
+}
+
+file_sink::~file_sink()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	cv.notify_all();
+	thread.join();
+}
+
+void file_sink::write(const std::string &text)
+{
+	bool wake = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!dirty) {
+			first_write = std::chrono::steady_clock::now();
+			wake = true;
+		}
+		if (mode == FILE_SINK_APPEND) {
+			buffer += text;
+			wake = wake || buffer.size() >= FILE_SINK_FLUSH_BYTES;
+		} else {
+			buffer = text;
+		}
+		dirty = true;
+	}
+	if (wake) {
+		cv.notify_all();
+	}
+}
+
+void file_sink::commit()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		committed = true;
+	}
+	cv.notify_all();
+}
+
+bool file_sink::write_file(const std::string &data, bool sync_data)
+{
+	const std::filesystem::path target = std::filesystem::u8path(path);
+	std::filesystem::path file_path = target;
+	if (mode == FILE_SINK_REPLACE) {
+		file_path += ".tmp";
+	}
+	FILE *file = open_file(file_path, mode == FILE_SINK_APPEND);
+	if (file == nullptr) {
+		return false;
+	}
+	bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+	if (ok && sync_data) {
+		ok = sync_file(file);
+	}
+	ok = fclose(file) == 0 && ok;
+	if (ok && mode == FILE_SINK_REPLACE) {
+		std::error_code ec;
+		std::filesystem::rename(file_path, target, ec);
+		ok = !ec;
+	}
+	return ok;
+}
+
+void file_sink::run()
+{
+	const std::chrono::milliseconds flush_delay(FILE_SINK_FLUSH_MS);
+	std::string data;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		if (!dirty) {
+			// the text of a commit may have been written before it without a sync
+			if (committed && unsynced && sync == FILE_SINK_SYNC_COMMIT) {
+				committed = false;
+				unsynced = false;
+				lock.unlock();
+				sync_path(std::filesystem::u8path(path));
+				lock.lock();
+				continue;
+			}
+			if (stopping) {
+				break;
+			}
+			committed = false;
+			cv.wait(lock);
+			continue;
+		}
+		// let more text collect unless the buffer is full, committed or the sink is closed
+		if (!stopping && !committed &&
+		    !(mode == FILE_SINK_APPEND && buffer.size() >= FILE_SINK_FLUSH_BYTES) &&
+		    std::chrono::steady_clock::now() < first_write + flush_delay) {
+			cv.wait_until(lock, first_write + flush_delay);
+			continue;
+		}
+		data.swap(buffer);
+		buffer.clear();
+		const bool sync_data = sync == FILE_SINK_SYNC_ALWAYS ||
+				       (sync == FILE_SINK_SYNC_COMMIT && (committed || stopping));
+		dirty = false;
+		committed = false;
+		unsynced = !sync_data;
+		lock.unlock();
+
+		if (!write_file(data, sync_data)) {
+			obs_log(LOG_WARNING, "Failed to write %s", path.c_str());
+		}
+
+		lock.lock();
+	}
+}
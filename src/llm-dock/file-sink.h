@@ -0,0 +1,65 @@
+#ifndef FILE_SINK_H
+#define FILE_SINK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum file_sink_mode {
+	// write the whole content to a temporary file and rename it over the target, so readers
+	// never see a half written file
+	FILE_SINK_REPLACE,
+	// append to the target
+	FILE_SINK_APPEND,
+};
+
+// when written data is forced to the disk with fsync
+enum file_sink_sync {
+	FILE_SINK_SYNC_NEVER = 0,
+	// when a generation is done (commit)
+	FILE_SINK_SYNC_COMMIT = 1,
+	// after every write to the file
+	FILE_SINK_SYNC_ALWAYS = 2,
+};
+
+/**
+  * @brief Write-behind file output: write() only updates an in-memory buffer and a background
+  * thread writes it out once FILE_SINK_FLUSH_BYTES are buffered, FILE_SINK_FLUSH_MS after the
+  * first buffered write, or on commit(). In replace mode only the latest content is kept, so
+  * streamed generations replace the file a few times per second instead of once per piece.
+  * The destructor writes what is left and joins the thread.
+  */
+class file_sink {
+public:
+	file_sink(const std::string &path, file_sink_mode mode, file_sink_sync sync);
+	~file_sink();
+
+	// append text (append mode) or replace the content (replace mode), never blocks on I/O
+	void write(const std::string &text);
+
+	// write the buffer out now, e.g. when a generation is done
+	void commit();
+
+private:
+	void run();
+	bool write_file(const std::string &data, bool sync);
+
+	std::string path;
+	file_sink_mode mode;
+	file_sink_sync sync;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::string buffer;
+	bool dirty = false;
+	bool committed = false;
+	// the last write was not synced
+	bool unsynced = false;
+	bool stopping = false;
+	std::chrono::steady_clock::time_point first_write;
+	std::thread thread;
+};
+
+#endif // FILE_SINK_H
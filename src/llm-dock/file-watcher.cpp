@@ -0,0 +1,350 @@
+#include "file-watcher.h"
+#include "plugin-support.h"
+
+#include <obs-module.h>
+
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+// ranges at least this large are read through a memory mapping instead of a buffered read
+static const size_t FILE_MMAP_MIN_BYTES = 64 * 1024;
+
+// map the pages holding the range and copy it into text
+static bool map_range(const std::filesystem::path &path, uint64_t offset, size_t length,
+		      std::string &text)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ,
+				  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+				  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		return false;
+	}
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const uint64_t start = offset - offset % info.dwAllocationGranularity;
+	const void *data = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(start >> 32),
+					 (DWORD)(start & 0xffffffff),
+					 (SIZE_T)(offset - start + length));
+	CloseHandle(mapping);
+	if (data == NULL) {
+		return false;
+	}
+	text.assign((const char *)data + (offset - start), length);
+	UnmapViewOfFile(data);
+	return true;
+#else
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	// a file that was truncated in the meantime must not be mapped past its end
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < offset + length) {
+		close(fd);
+		return false;
+	}
+	const uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+	const uint64_t start = offset - offset % page;
+	const size_t map_length = (size_t)(offset - start) + length;
+	void *data = mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE, fd, (off_t)start);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	text.assign((const char *)data + (offset - start), length);
+	munmap(data, map_length);
+	return true;
+#endif
+}
+
+static bool read_range(const std::filesystem::path &path, uint64_t offset, size_t length,
+		       std::string &text)
+{
+	text.clear();
+	if (length == 0) {
+		return true;
+	}
+	if (length >= FILE_MMAP_MIN_BYTES && map_range(path, offset, length, text)) {
+		return true;
+	}
+	std::ifstream file(path, std::ios::binary);
+	if (!file.seekg((std::streamoff)offset)) {
+		return false;
+	}
+	text.resize(length);
+	file.read(&text[0], (std::streamsize)length);
+	text.resize((size_t)file.gcount());
+	return true;
+}
+
+static bool is_continuation_byte(char c)
+{
+	return ((unsigned char)c & 0xc0) == 0x80;
+}
+
+static void skip_continuation_bytes(std::string &text)
+{
+	size_t start = 0;
+	while (start < text.size() && start < 3 && is_continuation_byte(text[start])) {
+		start++;
+	}
+	text.erase(0, start);
+}
+
+// length of the text without an incomplete UTF-8 sequence at its end
+static size_t complete_utf8_length(const std::string &text)
+{
+	for (size_t n = 1; n <= 4 && n <= text.size(); n++) {
+		const unsigned char c = (unsigned char)text[text.size() - n];
+		if ((c & 0xc0) == 0x80) {
+			continue;
+		}
+		const size_t length = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+		return length > n ? text.size() - n : text.size();
+	}
+	return text.size();
+}
+
+bool file_read_appended(const std::string &path, file_tail &tail, size_t max_bytes,
+			std::string &text)
+{
+	text.clear();
+	const std::filesystem::path file_path = std::filesystem::u8path(path);
+	std::error_code ec;
+	const uintmax_t size = std::filesystem::file_size(file_path, ec);
+	if (ec) {
+		return false;
+	}
+	if (!tail.started) {
+		tail.offset = size;
+		tail.started = true;
+		return true;
+	}
+	if (size < tail.offset) {
+		// truncated or replaced, read the new content from the start
+		tail.offset = 0;
+	}
+	uint64_t start = tail.offset;
+	const bool clipped = size - start > max_bytes;
+	if (clipped) {
+		start = size - max_bytes;
+	}
+	if (!read_range(file_path, start, (size_t)(size - start), text)) {
+		return false;
+	}
+	// the rest of a sequence that is still being written is read with the next change
+	text.resize(complete_utf8_length(text));
+	tail.offset = start + text.size();
+	if (clipped) {
+		skip_continuation_bytes(text);
+	}
+	return true;
+}
+
+bool file_read_window(const std::string &path, size_t max_bytes, std::string &text)
+{
+	text.clear();
+	const std::filesystem::path file_path = std::filesystem::u8path(path);
+	std::error_code ec;
+	const uintmax_t size = std::filesystem::file_size(file_path, ec);
+	if (ec) {
+		return false;
+	}
+	const uint64_t start = size > max_bytes ? size - max_bytes : 0;
+	if (!read_range(file_path, start, (size_t)(size - start), text)) {
+		return false;
+	}
+	if (start > 0) {
+		skip_continuation_bytes(text);
+	}
+	return true;
+}
+
+void text_keep_tail(std::string &text, size_t max_bytes)
+{
+	if (text.size() <= max_bytes) {
+		return;
+	}
+	text.erase(0, text.size() - max_bytes);
+	skip_continuation_bytes(text);
+}
+
+file_watcher::file_watcher(std::function<void(const std::string &)> callback, int poll_ms)
+	: callback(std::move(callback)),
+	  poll_ms(poll_ms)
+{
+}
+
+file_watcher::~file_watcher()
+{
+	stop();
+}
+
+void file_watcher::add(const std::string &path)
+{
+	watched_file file;
+	file.path = path;
+	files.push_back(std::move(file));
+}
+
+static bool stat_file(const std::string &path, uintmax_t &size, int64_t &time)
+{
+	const std::filesystem::path file_path = std::filesystem::u8path(path);
+	std::error_code ec;
+	size = std::filesystem::file_size(file_path, ec);
+	if (ec) {
+		return false;
+	}
+	time = (int64_t)std::filesystem::last_write_time(file_path, ec).time_since_epoch().count();
+	return !ec;
+}
+
+void file_watcher::start()
+{
+	stop();
+	bool polling = false;
+#ifdef __linux__
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd >= 0 && pipe2(stop_pipe, O_CLOEXEC) != 0) {
+		close(inotify_fd);
+		inotify_fd = -1;
+	}
+	for (watched_file &file : files) {
+		if (inotify_fd < 0) {
+			break;
+		}
+		// watch the directory, so files that are created or replaced are seen as well
+		const std::filesystem::path file_path = std::filesystem::u8path(file.path);
+		const std::filesystem::path dir =
+			file_path.has_parent_path() ? file_path.parent_path() : ".";
+		file.name = file_path.filename().u8string();
+		file.wd = inotify_add_watch(inotify_fd, dir.c_str(),
+					    IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO);
+	}
+#endif
+	for (watched_file &file : files) {
+		if (file.wd < 0) {
+			polling = true;
+			stat_file(file.path, file.size, file.time);
+		}
+	}
+	if (polling) {
+		obs_log(LOG_INFO, "Polling watched files every %d ms", poll_ms);
+	}
+	stopping = false;
+	thread = std::thread(&file_watcher::run, this);
+}
+
+void file_watcher::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(stop_mutex);
+		stopping = true;
+	}
+	stop_cv.notify_all();
+#ifdef __linux__
+	if (stop_pipe[1] >= 0) {
+		const char wake = 1;
+		if (write(stop_pipe[1], &wake, 1) < 0) {
+			obs_log(LOG_WARNING, "Failed to wake the file watcher");
+		}
+	}
+#endif
+	if (thread.joinable()) {
+		thread.join();
+	}
+#ifdef __linux__
+	for (int *fd : {&inotify_fd, &stop_pipe[0], &stop_pipe[1]}) {
+		if (*fd >= 0) {
+			close(*fd);
+			*fd = -1;
+		}
+	}
+#endif
+	for (watched_file &file : files) {
+		file.wd = -1;
+	}
+}
+
+void file_watcher::poll_files()
+{
+	for (watched_file &file : files) {
+		uintmax_t size = 0;
+		int64_t time = 0;
+		if (file.wd >= 0 || !stat_file(file.path, size, time) ||
+		    (size == file.size && time == file.time)) {
+			continue;
+		}
+		file.size = size;
+		file.time = time;
+		callback(file.path);
+	}
+}
+
+void file_watcher::run()
+{
+#ifdef __linux__
+	if (inotify_fd >= 0) {
+		bool polling = false;
+		for (const watched_file &file : files) {
+			polling = polling || file.wd < 0;
+		}
+		alignas(struct inotify_event) char buffer[4096];
+		while (true) {
+			struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+			const int ret = poll(fds, 2, polling ? poll_ms : -1);
+			if (ret < 0 && errno != EINTR) {
+				obs_log(LOG_ERROR, "File watcher failed: %d", errno);
+				return;
+			}
+			if (fds[1].revents != 0) {
+				return;
+			}
+			ssize_t n = 0;
+			while ((fds[0].revents & POLLIN) &&
+			       (n = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+				for (char *p = buffer; p < buffer + n;) {
+					const struct inotify_event *event =
+						(const struct inotify_event *)p;
+					for (const watched_file &file : files) {
+						if (event->len > 0 && file.wd == event->wd &&
+						    file.name == event->name) {
+							callback(file.path);
+						}
+					}
+					p += sizeof(struct inotify_event) + event->len;
+				}
+			}
+			poll_files();
+		}
+	}
+#endif
+	std::unique_lock<std::mutex> lock(stop_mutex);
+	while (!stop_cv.wait_for(lock, std::chrono::milliseconds(poll_ms),
+				 [this]() { return stopping; })) {
+		lock.unlock();
+		poll_files();
+		lock.lock();
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// read position of a file that is read incrementally
+struct file_tail {
+	uint64_t offset = 0;
+	bool started = false;
+};
+
+// Read the text appended to the file since the last call, at most the last max_bytes of it.
+// The first call only records the end of the file. Reading starts over at the beginning when
+// the file shrank, e.g. when it was truncated or replaced. An incomplete UTF-8 sequence at the
+// end is left for the next call. Large ranges are read through a memory mapping.
+bool file_read_appended(const std::string &path, file_tail &tail, size_t max_bytes,
+			std::string &text);
+
+// read the last max_bytes of the file, without reading the rest of it
+bool file_read_window(const std::string &path, size_t max_bytes, std::string &text);
+
+// drop bytes from the front until at most max_bytes are left, without splitting a UTF-8
+// sequence
+void text_keep_tail(std::string &text, size_t max_bytes);
+
+/**
+  * @brief Calls back when a watched file was written, created or replaced.
+  * On Linux the directories of the files are watched with inotify. Files in directories that
+  * cannot be watched, and all files on other platforms, are polled for size and modification
+  * time changes instead.
+  */
+class file_watcher {
+public:
+	// callback is called from the watcher thread with the path as it was added
+	file_watcher(std::function<void(const std::string &)> callback, int poll_ms = 500);
+	~file_watcher();
+
+	// watch a file, it does not have to exist yet. call before start().
+	void add(const std::string &path);
+
+	void start();
+	void stop();
+
+private:
+	struct watched_file {
+		std::string path;
+		// inotify watch of the directory, -1 if the file is polled
+		int wd = -1;
+		std::string name;
+		uintmax_t size = 0;
+		int64_t time = 0;
+	};
+
+	void run();
+	void poll_files();
+
+	std::function<void(const std::string &)> callback;
+	int poll_ms;
+	std::vector<watched_file> files;
+	std::thread thread;
+	std::mutex stop_mutex;
+	std::condition_variable stop_cv;
+	bool stopping = false;
+	// inotify descriptor and the pipe that wakes the thread to stop, -1 if not used
+	int inotify_fd = -1;
+	int stop_pipe[2] = {-1, -1};
+};
+
+#endif // FILE_WATCHER_H
@@ -0,0 +1,180 @@
+#include "inference-governor.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+
+#include <obs-module.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+static const int GOVERNOR_INTERVAL_MS = 1000;
+static const int GOVERNOR_RELAX_SAMPLES = 5;
+static const int GOVERNOR_MAX_LEVEL = 3;
+// lagged or skipped frames above this share of an interval are a struggle
+static const double GOVERNOR_MAX_DROPPED = 0.01;
+// frame times above this share of the frame interval leave no headroom, below the lower one
+// there is enough
+static const double GOVERNOR_BUSY_FRAME_TIME = 0.8;
+static const double GOVERNOR_IDLE_FRAME_TIME = 0.5;
+
+static std::mutex governor_mutex;
+static std::condition_variable governor_cv;
+static std::thread governor_thread;
+static bool governor_stopping = false;
+
+obs_health_source obs_health_source_libobs()
+{
+	return [](obs_health_sample &sample) {
+		video_t *video = obs_get_video();
+		if (video == nullptr) {
+			return false;
+		}
+		sample.lagged_frames = obs_get_lagged_frames();
+		sample.total_frames = obs_get_total_frames();
+		sample.skipped_frames = video_output_get_skipped_frames(video);
+		sample.encoded_frames = video_output_get_total_frames(video);
+		sample.average_frame_time_ns = obs_get_average_frame_time_ns();
+		sample.frame_interval_ns = obs_get_frame_interval_ns();
+		return true;
+	};
+}
+
+obs_health_source obs_health_source_simulated(std::vector<obs_health_sample> samples)
+{
+	auto next = std::make_shared<size_t>(0);
+	return [samples, next](obs_health_sample &sample) {
+		if (samples.empty()) {
+			return false;
+		}
+		sample = samples[std::min(*next, samples.size() - 1)];
+		++*next;
+		return true;
+	};
+}
+
+// counters only grow, unless OBS reset its video
+static uint32_t delta(uint32_t current, uint32_t previous)
+{
+	return current >= previous ? current - previous : 0;
+}
+
+inference_throttle inference_governor::throttle_for_level(int level)
+{
+	inference_throttle throttle;
+	throttle.level = level;
+	throttle.defer_background = level >= 1;
+	if (level == 2) {
+		throttle.step_pause_ms = 20;
+		throttle.max_batch_tokens = 64;
+	} else if (level >= 3) {
+		throttle.step_pause_ms = 100;
+		throttle.max_batch_tokens = 16;
+	}
+	return throttle;
+}
+
+inference_throttle inference_governor::update(const obs_health_sample &sample)
+{
+	if (!has_previous) {
+		has_previous = true;
+		previous = sample;
+		return throttle_for_level(level);
+	}
+	const uint32_t n_rendered = delta(sample.total_frames, previous.total_frames);
+	const uint32_t n_lagged = delta(sample.lagged_frames, previous.lagged_frames);
+	const uint32_t n_encoded = delta(sample.encoded_frames, previous.encoded_frames);
+	const uint32_t n_skipped = delta(sample.skipped_frames, previous.skipped_frames);
+	previous = sample;
+
+	const double frame_load =
+		sample.frame_interval_ns > 0
+			? (double)sample.average_frame_time_ns / sample.frame_interval_ns
+			: 0.0;
+	const bool struggling =
+		(n_rendered > 0 && n_lagged > n_rendered * GOVERNOR_MAX_DROPPED) ||
+		(n_encoded > 0 && n_skipped > n_encoded * GOVERNOR_MAX_DROPPED) ||
+		frame_load > GOVERNOR_BUSY_FRAME_TIME;
+	const bool healthy = n_lagged == 0 && n_skipped == 0 &&
+			     frame_load < GOVERNOR_IDLE_FRAME_TIME;
+
+	// throttle at once, release slowly
+	if (struggling) {
+		level = std::min(level + 1, GOVERNOR_MAX_LEVEL);
+		n_healthy = 0;
+	} else if (healthy && level > 0) {
+		if (++n_healthy >= GOVERNOR_RELAX_SAMPLES) {
+			level--;
+			n_healthy = 0;
+		}
+	} else {
+		n_healthy = 0;
+	}
+	return throttle_for_level(level);
+}
+
+static void governor(obs_health_source source,
+		     std::function<void(const inference_throttle &)> callback)
+{
+	inference_governor state;
+	int applied_level = 0;
+	std::unique_lock<std::mutex> lock(governor_mutex);
+	while (!governor_cv.wait_for(lock, std::chrono::milliseconds(GOVERNOR_INTERVAL_MS),
+				     []() { return governor_stopping; })) {
+		obs_health_sample sample;
+		inference_throttle throttle;
+		const bool sampled = llm_config_snapshot()->inference_governor && source(sample);
+		if (sampled) {
+			throttle = state.update(sample);
+		} else {
+			state = inference_governor();
+		}
+		if (throttle.level == applied_level) {
+			continue;
+		}
+		if (sampled) {
+			obs_log(LOG_INFO,
+				"OBS %s, inference throttle level %d (frame time %.1f of %.1f ms)",
+				throttle.level > applied_level ? "struggles" : "recovered",
+				throttle.level, sample.average_frame_time_ns / 1e6,
+				sample.frame_interval_ns / 1e6);
+		} else {
+			obs_log(LOG_INFO, "OBS not sampled, inference throttle level %d",
+				throttle.level);
+		}
+		applied_level = throttle.level;
+		// the callback takes the scheduler locks, ours is not held while it runs
+		lock.unlock();
+		callback(throttle);
+		lock.lock();
+	}
+	// leave nothing throttled behind
+	lock.unlock();
+	if (applied_level != 0) {
+		callback(inference_throttle());
+	}
+}
+
+void inference_governor_start(obs_health_source source,
+			      std::function<void(const inference_throttle &)> callback)
+{
+	inference_governor_stop();
+	std::lock_guard<std::mutex> lock(governor_mutex);
+	governor_stopping = false;
+	governor_thread = std::thread(governor, std::move(source), std::move(callback));
+}
+
+void inference_governor_stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(governor_mutex);
+		governor_stopping = true;
+	}
+	governor_cv.notify_all();
+	if (governor_thread.joinable()) {
+		governor_thread.join();
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef INFERENCE_GOVERNOR_H
+#define INFERENCE_GOVERNOR_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Throttles inference while OBS struggles, so the stream always wins over the LLM. The health
+// counters of OBS are sampled every GOVERNOR_INTERVAL_MS: a sample with lagged render frames,
+// skipped encoder frames or a frame time close to the frame interval raises the throttle level
+// at once, it is lowered one level after GOVERNOR_RELAX_SAMPLES healthy samples in a row.
+//   level 1: background requests (workflows) are deferred
+//   level 2: and decode steps are smaller and paused
+//   level 3: and even more so
+
+// health counters as libobs reports them, counted since OBS started
+struct obs_health_sample {
+	// frames the render thread missed and frames it rendered
+	uint32_t lagged_frames = 0;
+	uint32_t total_frames = 0;
+	// frames the encoders skipped and frames they got
+	uint32_t skipped_frames = 0;
+	uint32_t encoded_frames = 0;
+	// average time to render a frame and the frame interval of the video settings
+	uint64_t average_frame_time_ns = 0;
+	uint64_t frame_interval_ns = 0;
+};
+
+// false if no sample could be taken
+typedef std::function<bool(obs_health_sample &)> obs_health_source;
+
+// what the scheduler holds back
+struct inference_throttle {
+	int level = 0;
+	// queued background requests are not started
+	bool defer_background = false;
+	// pause after every decode step
+	int step_pause_ms = 0;
+	// max. tokens of a decode step, 0 for n_batch
+	int max_batch_tokens = 0;
+};
+
+// the counters of the running OBS
+obs_health_source obs_health_source_libobs();
+
+// replays the samples, one per call, and then repeats the last one. for testing the governor
+// without OBS.
+obs_health_source obs_health_source_simulated(std::vector<obs_health_sample> samples);
+
+class inference_governor {
+public:
+	// evaluate the interval since the previous sample
+	inference_throttle update(const obs_health_sample &sample);
+
+	static inference_throttle throttle_for_level(int level);
+
+private:
+	bool has_previous = false;
+	obs_health_sample previous;
+	int level = 0;
+	int n_healthy = 0;
+};
+
+// sample the source on a background thread and pass every change of the throttle to the
+// callback. the throttle is released while the inference_governor setting is off.
+void inference_governor_start(obs_health_source source,
+			      std::function<void(const inference_throttle &)> callback);
+
+// stop the thread, the callback is not called anymore once it returns
+void inference_governor_stop();
+
+#endif // INFERENCE_GOVERNOR_H
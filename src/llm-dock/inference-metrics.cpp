@@ -0,0 +1,200 @@
+#include "inference-metrics.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+
+#include <obs-module.h>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+// number of recent requests the aggregates are computed over
+static const size_t METRICS_WINDOW = 50;
+
+static std::mutex metrics_mutex;
+static std::deque<inference_metrics> recent;
+static std::function<void(const inference_metrics &, const inference_metrics_summary &)> listener;
+static std::ofstream log_file;
+static int cache_hits = 0;
+static int cache_misses = 0;
+
+const char *inference_stop_reason_name(inference_stop_reason stop_reason)
+{
+	switch (stop_reason) {
+	case INFERENCE_STOP_EOS:
+		return "eos";
+	case INFERENCE_STOP_STRING:
+		return "stop_string";
+	case INFERENCE_STOP_LENGTH:
+		return "length";
+	case INFERENCE_STOP_CANCELLED:
+		return "cancelled";
+	case INFERENCE_STOP_DROPPED:
+		return "dropped";
+	case INFERENCE_STOP_FAILED:
+	default:
+		return "failed";
+	}
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+	if (values.empty()) {
+		return 0.0;
+	}
+	const size_t n = (size_t)(p * (double)(values.size() - 1) + 0.5);
+	std::nth_element(values.begin(), values.begin() + n, values.end());
+	return values[n];
+}
+
+static inference_metrics_summary summarize()
+{
+	inference_metrics_summary summary;
+	std::vector<double> ttft;
+	std::vector<double> queue_wait;
+	double n_tokens = 0.0;
+	double decode_ms = 0.0;
+	int n_drafted = 0;
+	int n_draft_accepted = 0;
+	for (const inference_metrics &m : recent) {
+		ttft.push_back(m.ttft_ms);
+		queue_wait.push_back(m.queue_wait_ms);
+		n_tokens += m.n_generated;
+		decode_ms += m.decode_ms;
+		n_drafted += m.n_drafted;
+		n_draft_accepted += m.n_draft_accepted;
+	}
+	summary.n_requests = (int)recent.size();
+	summary.ttft_p50_ms = percentile(ttft, 0.5);
+	summary.ttft_p95_ms = percentile(ttft, 0.95);
+	summary.queue_wait_p95_ms = percentile(queue_wait, 0.95);
+	summary.decode_tokens_per_second =
+		decode_ms > 0.0 ? (float)(n_tokens * 1000.0 / decode_ms) : 0.0f;
+	summary.draft_acceptance = n_drafted > 0 ? (float)n_draft_accepted / n_drafted : 0.0f;
+	summary.cache_hits = cache_hits;
+	summary.cache_misses = cache_misses;
+	return summary;
+}
+
+static void append_log(const inference_metrics &metrics)
+{
+	if (!llm_config_snapshot()->metrics_log) {
+		if (log_file.is_open()) {
+			log_file.close();
+		}
+		return;
+	}
+	if (!log_file.is_open()) {
+		char *path = obs_module_config_path("metrics.jsonl");
+		if (path == nullptr) {
+			return;
+		}
+		log_file.open(path, std::ios::app);
+		if (!log_file.is_open()) {
+			obs_log(LOG_WARNING, "Failed to open the metrics log %s", path);
+		}
+		bfree(path);
+		if (!log_file.is_open()) {
+			return;
+		}
+	}
+
+	nlohmann::json j;
+	j["time_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+			       std::chrono::system_clock::now().time_since_epoch())
+			       .count();
+	j["priority"] = metrics.priority == INFERENCE_PRIORITY_INTERACTIVE ? "interactive"
+									    : "background";
+	j["stop_reason"] = inference_stop_reason_name(metrics.stop_reason);
+	j["queue_wait_ms"] = metrics.queue_wait_ms;
+	j["tokenize_ms"] = metrics.tokenize_ms;
+	j["prefill_ms"] = metrics.prefill_ms;
+	j["ttft_ms"] = metrics.ttft_ms;
+	j["decode_ms"] = metrics.decode_ms;
+	j["decode_tokens_per_second"] = metrics.decode_tokens_per_second;
+	j["prompt_tokens"] = metrics.n_prompt;
+	j["cached_tokens"] = metrics.n_cached;
+	j["generated_tokens"] = metrics.n_generated;
+	j["drafted_tokens"] = metrics.n_drafted;
+	j["accepted_draft_tokens"] = metrics.n_draft_accepted;
+	j["kv_cells_used"] = metrics.kv_cells_used;
+	j["cache_hits"] = cache_hits;
+	j["cache_misses"] = cache_misses;
+	log_file << j.dump() << "\n";
+	log_file.flush();
+}
+
+void inference_metrics_record(const inference_metrics &metrics)
+{
+	inference_metrics_summary summary;
+	std::function<void(const inference_metrics &, const inference_metrics_summary &)> callback;
+	{
+		std::lock_guard<std::mutex> lock(metrics_mutex);
+		// requests that never generated would skew the latency aggregates
+		if (metrics.n_generated > 0) {
+			recent.push_back(metrics);
+			if (recent.size() > METRICS_WINDOW) {
+				recent.pop_front();
+			}
+		}
+		append_log(metrics);
+		summary = summarize();
+		callback = listener;
+	}
+	if (callback) {
+		callback(metrics, summary);
+	}
+}
+
+void inference_metrics_record_cache(bool hit)
+{
+	std::lock_guard<std::mutex> lock(metrics_mutex);
+	if (hit) {
+		cache_hits++;
+	} else {
+		cache_misses++;
+	}
+}
+
+inference_metrics_summary inference_metrics_get_summary()
+{
+	std::lock_guard<std::mutex> lock(metrics_mutex);
+	return summarize();
+}
+
+void inference_metrics_set_listener(
+	std::function<void(const inference_metrics &, const inference_metrics_summary &)> callback)
+{
+	std::lock_guard<std::mutex> lock(metrics_mutex);
+	listener = callback;
+}
+
+std::string inference_metrics_status_text(const inference_metrics &metrics,
+					  const inference_metrics_summary &summary)
+{
+	char text[256];
+	snprintf(text, sizeof(text),
+		 "TTFT %.0f ms (queue %.0f, prefill %.0f) | %d tok @ %.1f t/s | %s | KV %d | "
+		 "last %d: TTFT p50 %.0f / p95 %.0f ms, %.1f t/s",
+		 metrics.ttft_ms, metrics.queue_wait_ms, metrics.prefill_ms, metrics.n_generated,
+		 metrics.decode_tokens_per_second, inference_stop_reason_name(metrics.stop_reason),
+		 metrics.kv_cells_used, summary.n_requests, summary.ttft_p50_ms,
+		 summary.ttft_p95_ms, summary.decode_tokens_per_second);
+	std::string status = text;
+	if (metrics.n_drafted > 0) {
+		snprintf(text, sizeof(text), " | draft %d / %d accepted (last %d: %.0f%%)",
+			 metrics.n_draft_accepted, metrics.n_drafted, summary.n_requests,
+			 summary.draft_acceptance * 100.0f);
+		status += text;
+	}
+	if (summary.cache_hits + summary.cache_misses > 0) {
+		snprintf(text, sizeof(text), " | cache %d / %d hits", summary.cache_hits,
+			 summary.cache_hits + summary.cache_misses);
+		status += text;
+	}
+	return status;
+}
@@ -0,0 +1,43 @@
+#ifndef INFERENCE_METRICS_H
+#define INFERENCE_METRICS_H
+
+#include "inference-scheduler.h"
+
+#include <functional>
+#include <string>
+
+// rolling aggregates over the most recent requests that generated text
+struct inference_metrics_summary {
+	int n_requests = 0;
+	double ttft_p50_ms = 0.0;
+	double ttft_p95_ms = 0.0;
+	double queue_wait_p95_ms = 0.0;
+	float decode_tokens_per_second = 0.0f;
+	// share of the draft tokens the model accepted, 0 without speculative decoding
+	float draft_acceptance = 0.0f;
+	// workflow requests answered from the response cache and not found in it, since start
+	int cache_hits = 0;
+	int cache_misses = 0;
+};
+
+const char *inference_stop_reason_name(inference_stop_reason stop_reason);
+
+// record the metrics of a finished request: update the aggregates, append a JSON line to
+// metrics.jsonl in the module config folder when enabled in the settings, and notify the
+// listener
+void inference_metrics_record(const inference_metrics &metrics);
+
+// count a response cache lookup
+void inference_metrics_record_cache(bool hit);
+
+inference_metrics_summary inference_metrics_get_summary();
+
+// called from the thread that recorded the metrics
+void inference_metrics_set_listener(
+	std::function<void(const inference_metrics &, const inference_metrics_summary &)> listener);
+
+// one line status for the dock
+std::string inference_metrics_status_text(const inference_metrics &metrics,
+					  const inference_metrics_summary &summary);
+
+#endif // INFERENCE_METRICS_H
@@ -0,0 +1,1013 @@
+#include "inference-scheduler.h"
+#include "llama-inference.h"
+#include "llama-sampler.h"
+#include "stop-matcher.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+#include "thread-policy.h"
+
+#include <obs-module.h>
+
+#include <algorithm>
+#include <chrono>
+
+cancellation_token make_cancellation_token()
+{
+	return std::make_shared<std::atomic<bool>>(false);
+}
+
+inference_scheduler::inference_scheduler(struct llama_context *ctx_, int n_batch_, int n_parallel,
+					 size_t max_queue_, inference_queue_policy policy_)
+	: n_batch(std::max(n_batch_, 1)),
+	  max_queue(std::max<size_t>(max_queue_, 1)),
+	  policy(policy_)
+{
+	batch = llama_batch_init(n_batch, 0, 1);
+	resize(n_batch, n_parallel);
+	set_context(ctx_);
+	thread = std::thread(&inference_scheduler::worker, this);
+}
+
+void inference_scheduler::resize(int n_batch_, int n_parallel)
+{
+	if (n_batch_ > 0 && n_batch_ != n_batch) {
+		llama_batch_free(batch);
+		n_batch = n_batch_;
+		batch = llama_batch_init(n_batch, 0, 1);
+	}
+	if (n_parallel > 0) {
+		slots.clear();
+		slots.resize(n_parallel);
+		for (size_t i = 0; i < slots.size(); i++) {
+			// sequence 0 is reserved for the prompt prefix
+			slots[i].seq_id = (llama_seq_id)(i + 1);
+		}
+	}
+}
+
+std::future<struct llama_context *> inference_scheduler::set_context(struct llama_context *ctx_,
+								     int n_batch_, int n_parallel,
+								     bool kv_shift_)
+{
+	std::future<struct llama_context *> released;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (has_pending_ctx) {
+			// the previous pending context is replaced before it was ever used
+			pending_ctx_released.set_value(pending_ctx);
+		}
+		pending_ctx_released = std::promise<struct llama_context *>();
+		released = pending_ctx_released.get_future();
+		pending_ctx = ctx_;
+		has_pending_ctx = true;
+		pending_n_batch = n_batch_;
+		pending_n_parallel = n_parallel;
+		pending_kv_shift = kv_shift_;
+		target_ctx = ctx_;
+		if (stopped) {
+			switch_stopped();
+		}
+	}
+	cv.notify_one();
+	return released;
+}
+
+std::future<struct llama_context *>
+inference_scheduler::set_draft_context(struct llama_context *draft_ctx_)
+{
+	std::future<struct llama_context *> released;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (has_pending_draft_ctx) {
+			pending_draft_ctx_released.set_value(pending_draft_ctx);
+		}
+		pending_draft_ctx_released = std::promise<struct llama_context *>();
+		released = pending_draft_ctx_released.get_future();
+		pending_draft_ctx = draft_ctx_;
+		has_pending_draft_ctx = true;
+		if (stopped) {
+			switch_stopped();
+		}
+	}
+	cv.notify_one();
+	return released;
+}
+
+// without a worker thread the switches happen at once, so a caller waiting for the released
+// context (e.g. a model reload during shutdown) does not wait forever and frees the contexts
+// as after any switch
+void inference_scheduler::switch_stopped()
+{
+	if (has_pending_ctx) {
+		pending_ctx_released.set_value(ctx);
+		ctx = pending_ctx;
+		pending_ctx = nullptr;
+		has_pending_ctx = false;
+	}
+	if (has_pending_draft_ctx) {
+		pending_draft_ctx_released.set_value(draft_ctx);
+		draft_ctx = pending_draft_ctx;
+		pending_draft_ctx = nullptr;
+		has_pending_draft_ctx = false;
+	}
+}
+
+void inference_scheduler::set_wakeup_callback(std::function<void()> callback)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	wakeup_callback = callback;
+}
+
+int64_t inference_scheduler::idle_since_us()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return idle_since;
+}
+
+void inference_scheduler::set_metrics_callback(
+	std::function<void(const inference_metrics &)> callback)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	metrics_callback = callback;
+}
+
+void inference_scheduler::set_prefix_state_callbacks(
+	std::function<bool(struct llama_context *, const std::vector<llama_token> &)> load,
+	std::function<void(struct llama_context *, const std::vector<llama_token> &)> save)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	prefix_state_load = load;
+	prefix_state_save = save;
+}
+
+inference_scheduler::~inference_scheduler()
+{
+	stop();
+	llama_batch_free(batch);
+}
+
+void inference_scheduler::finish(queued_job &entry, const std::string &output,
+				 const inference_metrics &metrics)
+{
+	if (entry.job.done_callback) {
+		entry.job.done_callback(output, metrics.stop_reason);
+	}
+	entry.result.set_value(output);
+
+	std::function<void(const inference_metrics &)> callback;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		callback = metrics_callback;
+	}
+	if (callback) {
+		callback(metrics);
+	}
+}
+
+// a request that ends before it started generating
+void inference_scheduler::finish(queued_job &entry, inference_stop_reason stop_reason)
+{
+	inference_metrics metrics;
+	metrics.priority = entry.job.priority;
+	metrics.stop_reason = stop_reason;
+	metrics.queue_wait_ms = (ggml_time_us() - entry.t_submit_us) / 1000.0;
+	finish(entry, "", metrics);
+}
+
+// orders queued requests by priority (highest first) and then by submission order
+static bool runs_before(inference_priority priority_a, uint64_t seq_a,
+			inference_priority priority_b, uint64_t seq_b)
+{
+	if (priority_a != priority_b) {
+		return priority_a > priority_b;
+	}
+	return seq_a < seq_b;
+}
+
+std::future<std::string> inference_scheduler::submit(inference_job job)
+{
+	if (!job.cancel) {
+		job.cancel = make_cancellation_token();
+	}
+	if (!job.config) {
+		job.config = llm_config_snapshot();
+	}
+
+	std::unique_ptr<queued_job> entry = std::make_unique<queued_job>();
+	entry->job = std::move(job);
+	entry->t_submit_us = ggml_time_us();
+	std::future<std::string> result = entry->result.get_future();
+
+	std::unique_ptr<queued_job> dropped;
+	std::function<void()> wakeup;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		idle_since = 0;
+		if (target_ctx == nullptr) {
+			wakeup = wakeup_callback;
+		}
+		if (stopping) {
+			dropped = std::move(entry);
+		} else {
+			if (queue.size() >= max_queue) {
+				// the victim is the oldest request of the lowest priority
+				auto victim = std::min_element(
+					queue.begin(), queue.end(),
+					[](const std::unique_ptr<queued_job> &a,
+					   const std::unique_ptr<queued_job> &b) {
+						if (a->job.priority != b->job.priority) {
+							return a->job.priority < b->job.priority;
+						}
+						return a->seq < b->seq;
+					});
+				if (policy == INFERENCE_QUEUE_DROP_OLDEST &&
+				    (*victim)->job.priority <= entry->job.priority) {
+					dropped = std::move(*victim);
+					queue.erase(victim);
+				} else {
+					dropped = std::move(entry);
+				}
+			}
+			if (entry) {
+				entry->seq = next_seq++;
+				queue.push_back(std::move(entry));
+			}
+		}
+	}
+	cv.notify_one();
+
+	if (dropped) {
+		obs_log(LOG_WARNING, "inference queue is full, dropping a request");
+		finish(*dropped, INFERENCE_STOP_DROPPED);
+	}
+	if (wakeup) {
+		wakeup();
+	}
+	return result;
+}
+
+size_t inference_scheduler::queued()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return queue.size();
+}
+
+void inference_scheduler::cancel_queued()
+{
+	std::vector<std::unique_ptr<queued_job>> cancelled;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		cancelled.swap(queue);
+	}
+	for (auto &entry : cancelled) {
+		finish(*entry, INFERENCE_STOP_CANCELLED);
+	}
+}
+
+void inference_scheduler::reset_session(const std::string &name)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		session_resets.push_back(name);
+	}
+	cv.notify_one();
+}
+
+void inference_scheduler::set_throttle(const inference_throttle &throttle_)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		throttle = throttle_;
+	}
+	cv.notify_one();
+}
+
+void inference_scheduler::stop()
+{
+	std::vector<std::unique_ptr<queued_job>> cancelled;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		cancelled.swap(queue);
+	}
+	cv.notify_all();
+
+	for (auto &entry : cancelled) {
+		finish(*entry, INFERENCE_STOP_CANCELLED);
+	}
+	if (thread.joinable()) {
+		thread.join();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stopped = true;
+	switch_stopped();
+}
+
+bool inference_scheduler::prepare_prefix(const std::string &prefix, const inference_job &job)
+{
+	if (prefix_valid && prefix_text == prefix) {
+		return true;
+	}
+
+	// slots still using the old prefix keep their copy of it
+	llama_kv_cache_seq_rm(ctx, 0, -1, -1);
+	prefix_valid = false;
+
+	std::vector<llama_token> tokens = ::llama_tokenize(ctx, prefix, true);
+
+	// a saved state replaces the whole KV cache, so it is only used while all slots are idle
+	// and no conversation is parked
+	std::function<bool(struct llama_context *, const std::vector<llama_token> &)> load;
+	std::function<void(struct llama_context *, const std::vector<llama_token> &)> save;
+	if (resident_session.empty() &&
+	    std::all_of(slots.begin(), slots.end(),
+			[](const slot &s) { return s.state == SLOT_IDLE; })) {
+		std::lock_guard<std::mutex> lock(mutex);
+		load = prefix_state_load;
+		save = prefix_state_save;
+	}
+
+	if (!load || !load(ctx, tokens)) {
+		obs_log(LOG_INFO, "%s: decoding prompt prefix of %d tokens", __func__,
+			(int)tokens.size());
+		if (!llama_prefill(
+			    ctx, batch, n_batch, tokens, 0, 0, false,
+			    [&job]() { return job.cancel->load(); },
+			    job.prefill_progress_callback)) {
+			obs_log(LOG_ERROR, "%s: failed to decode the prompt prefix", __func__);
+			llama_kv_cache_seq_rm(ctx, 0, -1, -1);
+			return false;
+		}
+		if (save) {
+			save(ctx, tokens);
+		}
+	}
+
+	prefix_text = prefix;
+	prefix_tokens = std::move(tokens);
+	prefix_valid = true;
+	return true;
+}
+
+bool inference_scheduler::admit(slot &s, std::unique_ptr<queued_job> entry)
+{
+	s.entry = std::move(entry);
+	const inference_job &job = s.entry->job;
+	const llm_config_data &config = *job.config;
+
+	// split the system prompt at the first {0}: the static prefix is decoded once into
+	// sequence 0 and shared, only the part with the user prompt is decoded per request
+	const std::string &prompt_template = config.system_prompt;
+	const size_t input_pos = prompt_template.find("{0}");
+	const bool use_prefix_cache = config.prefix_cache &&
+				      input_pos != std::string::npos && input_pos > 0;
+
+	// a chat session continues its conversation: a follow-up turn uses the turn template
+	chat_session *session = nullptr;
+	s.session_id = 0;
+	if (!job.session.empty()) {
+		auto found = sessions.find(job.session);
+		if (found == sessions.end()) {
+			found = sessions.emplace(job.session, chat_session()).first;
+			found->second.id = ++next_session_id;
+		}
+		session = &found->second;
+		s.session_id = session->id;
+	}
+	const bool follow_up = session != nullptr && !session->tokens.empty();
+	const bool resident = follow_up && resident_session == job.session;
+	const std::vector<llama_token> no_history;
+	const std::vector<llama_token> &history =
+		follow_up && !resident ? session->tokens : no_history;
+
+	s.t_start_us = ggml_time_us();
+	s.n_past = 0;
+	s.tokens.clear();
+	if (resident) {
+		// the cells of the earlier turns move from the chat sequence to the slot
+		llama_kv_cache_seq_cp(ctx, chat_seq_id(), s.seq_id, -1, -1);
+		llama_kv_cache_seq_rm(ctx, chat_seq_id(), -1, -1);
+		resident_session.clear();
+		s.tokens = session->tokens;
+		s.n_past = (int)s.tokens.size();
+	} else if (use_prefix_cache) {
+		if (!prepare_prefix(prompt_template.substr(0, input_pos), job)) {
+			return false;
+		}
+		// a conversation that is not parked is decoded again after the shared prefix
+		if (history.size() >= prefix_tokens.size() &&
+		    std::equal(prefix_tokens.begin(), prefix_tokens.end(), history.begin())) {
+			llama_kv_cache_seq_cp(ctx, 0, s.seq_id, -1, -1);
+			s.tokens = prefix_tokens;
+			s.n_past = (int)prefix_tokens.size();
+		}
+	}
+	s.prompt.assign(history.begin() + std::min((size_t)s.n_past, history.size()),
+			history.end());
+
+	// replace {0} with the prompt in the turn template, the rest of the system prompt after
+	// the cached prefix or the whole system prompt
+	const int64_t t_tokenize_start_us = ggml_time_us();
+	std::string turn;
+	if (follow_up) {
+		const std::string &turn_template = config.chat_turn_template;
+		turn = replace(!turn_template.empty() ? turn_template
+				: input_pos != std::string::npos ? prompt_template.substr(input_pos)
+								 : "{0}",
+			       "{0}", job.prompt);
+	} else if (s.n_past > 0) {
+		turn = replace(prompt_template.substr(input_pos), "{0}", job.prompt);
+	} else {
+		turn = replace(prompt_template, "{0}", job.prompt);
+	}
+	const std::vector<llama_token> turn_tokens =
+		::llama_tokenize(ctx, turn, !follow_up && s.n_past == 0);
+	s.prompt.insert(s.prompt.end(), turn_tokens.begin(), turn_tokens.end());
+	s.t_tokenize_us = ggml_time_us() - t_tokenize_start_us;
+
+	// the prefix is kept when the context is shifted, otherwise only the BOS token
+	s.n_keep = 1;
+	if (use_prefix_cache && s.n_past > 0 && !resident) {
+		s.n_keep = (int)prefix_tokens.size();
+	} else if (input_pos != std::string::npos && input_pos > 0) {
+		s.n_keep = (int)::llama_tokenize(ctx, prompt_template.substr(0, input_pos), true)
+				   .size();
+	}
+	s.n_cached = s.n_past;
+	s.tokens.insert(s.tokens.end(), s.prompt.begin(), s.prompt.end());
+	s.n_shifted = 0;
+
+	// a long conversation drops its oldest turns after the prefix, leaving a quarter of the
+	// sequence for the answer
+	const int n_history = (int)s.tokens.size() - (int)turn_tokens.size();
+	const int n_discard = std::min((int)s.tokens.size() + n_seq_ctx / 4 - n_seq_ctx,
+				       n_history - s.n_keep);
+	if (follow_up && n_discard > 0) {
+		// parked: the cells of the dropped turns are removed and the rest shifted, or
+		// decoded again when the cells cannot be shifted
+		if (!(s.n_past > s.n_keep && shift_context(s, n_discard))) {
+			if (s.n_past > s.n_keep) {
+				llama_kv_cache_seq_rm(ctx, s.seq_id, s.n_keep, -1);
+				s.prompt.assign(s.tokens.begin() + s.n_keep, s.tokens.end());
+				s.n_past = s.n_keep;
+			}
+			s.prompt.erase(s.prompt.begin() + (s.n_keep - s.n_past),
+				       s.prompt.begin() + (s.n_keep - s.n_past + n_discard));
+			s.tokens.erase(s.tokens.begin() + s.n_keep,
+				       s.tokens.begin() + s.n_keep + n_discard);
+		}
+		s.n_cached = s.n_past;
+	}
+
+	if (s.prompt.empty() || s.n_past + (int)s.prompt.size() >= n_seq_ctx) {
+		obs_log(LOG_ERROR, "%s: prompt of %d tokens does not fit in a sequence of %d",
+			__func__, s.n_past + (int)s.prompt.size(), n_seq_ctx);
+		llama_kv_cache_seq_rm(ctx, s.seq_id, -1, -1);
+		return false;
+	}
+
+	// the sampler buffers are allocated once per slot and model
+	if (!s.sampler || s.sampler->get_model() != llama_get_model(ctx)) {
+		s.sampler = std::make_unique<llama_sampler>(
+			llama_get_model(ctx), llama_sampler_params_from_config(config));
+	} else {
+		s.sampler->reset(llama_sampler_params_from_config(config));
+	}
+	for (llama_token token : s.prompt) {
+		s.sampler->accept(token);
+	}
+
+	// stop sequences are compiled once per request and matched on the new text only
+	s.stop = std::make_unique<stop_matcher>(stop_matcher_from_config(config));
+
+	s.state = SLOT_PREFILL;
+	s.n_prompt_done = 0;
+	s.n_decoded = 0;
+	s.n_drafted = 0;
+	s.n_draft_accepted = 0;
+	s.n_max_output = config.max_output_tokens;
+	s.output.clear();
+	return true;
+}
+
+void inference_scheduler::release(slot &s, inference_stop_reason stop_reason)
+{
+	if (s.state == SLOT_GENERATE && !*s.entry->job.cancel) {
+		// emit the text that was held back as a possible stop sequence prefix
+		const std::string rest = s.stop->flush();
+		if (!rest.empty()) {
+			if (s.entry->job.partial_generation_callback) {
+				s.entry->job.partial_generation_callback(rest);
+			}
+			s.output += rest;
+		}
+	}
+
+	const int64_t t_end_us = ggml_time_us();
+	inference_metrics metrics;
+	metrics.priority = s.entry->job.priority;
+	metrics.stop_reason = stop_reason;
+	metrics.queue_wait_ms = (s.t_start_us - s.entry->t_submit_us) / 1000.0;
+	metrics.tokenize_ms = s.t_tokenize_us / 1000.0;
+	metrics.n_prompt = (int)s.prompt.size();
+	metrics.n_cached = s.n_cached;
+	metrics.n_generated = s.n_decoded;
+	metrics.n_drafted = s.n_drafted;
+	metrics.n_draft_accepted = s.n_draft_accepted;
+	metrics.kv_cells_used = llama_get_kv_cache_token_count(ctx);
+	if (s.state == SLOT_GENERATE) {
+		metrics.prefill_ms = (s.t_generate_us - s.t_start_us - s.t_tokenize_us) / 1000.0;
+		metrics.ttft_ms = (s.t_generate_us - s.entry->t_submit_us) / 1000.0;
+		metrics.decode_ms = (t_end_us - s.t_generate_us) / 1000.0;
+		if (metrics.decode_ms > 0.0) {
+			metrics.decode_tokens_per_second =
+				(float)(s.n_decoded * 1000.0 / metrics.decode_ms);
+		}
+	} else {
+		metrics.prefill_ms = (t_end_us - s.t_start_us - s.t_tokenize_us) / 1000.0;
+	}
+
+	if (s.n_decoded > 0) {
+		obs_log(LOG_INFO, "%s: slot %d decoded %d tokens in %.2f s, speed: %.2f t/s",
+			__func__, s.seq_id, s.n_decoded, metrics.decode_ms / 1000.0,
+			metrics.decode_tokens_per_second);
+	}
+	if (s.n_shifted > 0) {
+		obs_log(LOG_INFO, "%s: slot %d shifted its context %d times", __func__, s.seq_id,
+			s.n_shifted);
+	}
+	if (s.n_drafted > 0) {
+		obs_log(LOG_INFO, "%s: slot %d accepted %d of %d draft tokens (%.0f%%)", __func__,
+			s.seq_id, s.n_draft_accepted, s.n_drafted,
+			100.0 * s.n_draft_accepted / s.n_drafted);
+	}
+
+	park_session(s);
+
+	// free the KV cells of the sequence
+	llama_kv_cache_seq_rm(ctx, s.seq_id, -1, -1);
+
+	std::unique_ptr<queued_job> entry = std::move(s.entry);
+	std::string output = std::move(s.output);
+	s.state = SLOT_IDLE;
+	s.output.clear();
+	s.prompt.clear();
+	s.tokens.clear();
+	finish(*entry, output, metrics);
+}
+
+// handle a token sampled for a slot: end the request at the end of stream, the context length
+// or a stop string, pass its text on otherwise. false if the slot was released.
+bool inference_scheduler::emit(slot &s, llama_token token)
+{
+	s.sampler->accept(token);
+	if (s.entry->job.token_callback) {
+		s.entry->job.token_callback(token);
+	}
+
+	// is it an end of stream?
+	const llama_token eos = llama_token_eos(llama_get_model(ctx));
+	if (token == eos) {
+		release(s, INFERENCE_STOP_EOS);
+		return false;
+	}
+	if (s.n_past >= n_seq_ctx &&
+	    !(s.entry->job.config->context_shift && shift_context(s, (s.n_past - s.n_keep) / 2))) {
+		release(s, INFERENCE_STOP_LENGTH);
+		return false;
+	}
+
+	// hold back text that may be the start of a stop sequence
+	const std::string piece = s.stop->feed(llama_token_to_piece(ctx, token));
+	if (!piece.empty()) {
+		if (s.entry->job.partial_generation_callback) {
+			s.entry->job.partial_generation_callback(piece);
+		}
+		s.output += piece;
+	}
+	s.n_decoded += 1;
+	if (s.stop->stopped()) {
+		release(s, INFERENCE_STOP_STRING);
+		return false;
+	}
+	if (s.n_max_output > 0 && s.n_decoded >= s.n_max_output) {
+		release(s, INFERENCE_STOP_LENGTH);
+		return false;
+	}
+
+	s.last_token = token;
+	s.tokens.push_back(token);
+	return true;
+}
+
+// make room in a sequence: drop n_discard tokens after the kept prefix and shift the
+// positions of the rest down, the RoPE of their cached keys is updated in place by the next
+// decode. the kept prefix covers the cells shared with sequence 0, so they never move.
+// false if there is nothing to drop or the cells of the context cannot be shifted.
+bool inference_scheduler::shift_context(slot &s, int n_discard)
+{
+	const int n_keep = s.n_keep;
+	if (!kv_shift || n_discard <= 0 || n_keep + n_discard > s.n_past) {
+		return false;
+	}
+	llama_kv_cache_seq_rm(ctx, s.seq_id, n_keep, n_keep + n_discard);
+	llama_kv_cache_seq_shift(ctx, s.seq_id, n_keep + n_discard, s.n_past, -n_discard);
+	s.n_past -= n_discard;
+	s.tokens.erase(s.tokens.begin() + n_keep, s.tokens.begin() + n_keep + n_discard);
+	s.n_shifted += 1;
+	return true;
+}
+
+// one step of a request that generates alone: the draft model proposes up to n_draft tokens
+// greedily, a single decode of the model scores the last token and all of them, and the tokens
+// are kept as long as the model samples the same ones. false if no draft was made, then the
+// step is decoded normally.
+bool inference_scheduler::speculate(slot &s)
+{
+	const int n_draft = std::min({s.entry->job.config->n_draft, step_batch() - 1,
+				      n_seq_ctx - s.n_past - 2,
+				      (int)llama_n_ctx(draft_ctx) - (int)s.tokens.size()});
+	const struct llama_model *draft_model = llama_get_model(draft_ctx);
+	if (n_draft <= 0 || llama_n_vocab(draft_model) != llama_n_vocab(llama_get_model(ctx))) {
+		return false;
+	}
+
+	// catch the draft sequence up with the slot, usually only the tokens accepted in the last
+	// step are missing. the last token is decoded again when its logits are gone.
+	size_t n_keep = 0;
+	while (n_keep < draft_tokens.size() && n_keep + 1 < s.tokens.size() &&
+	       draft_tokens[n_keep] == s.tokens[n_keep]) {
+		n_keep++;
+	}
+	llama_kv_cache_seq_rm(draft_ctx, 0, (llama_pos)n_keep, -1);
+	const std::vector<llama_token> missing(s.tokens.begin() + n_keep, s.tokens.end());
+	if (!llama_prefill(draft_ctx, batch, n_batch, missing, (int)n_keep, 0, true)) {
+		llama_kv_cache_seq_rm(draft_ctx, 0, -1, -1);
+		draft_tokens.clear();
+		return false;
+	}
+	draft_tokens = s.tokens;
+
+	const int n_vocab = llama_n_vocab(draft_model);
+	const llama_token eos = llama_token_eos(llama_get_model(ctx));
+	std::vector<llama_token> draft;
+	int i_logits = batch.n_tokens - 1;
+	for (;;) {
+		const float *logits = llama_get_logits_ith(draft_ctx, i_logits);
+		const llama_token token =
+			(llama_token)(std::max_element(logits, logits + n_vocab) - logits);
+		draft.push_back(token);
+		if ((int)draft.size() == n_draft || token == eos) {
+			break;
+		}
+		llama_batch_clear(batch);
+		llama_batch_add(batch, token, (llama_pos)draft_tokens.size(), {0}, true);
+		if (llama_decode(draft_ctx, batch) != 0) {
+			break;
+		}
+		draft_tokens.push_back(token);
+		i_logits = 0;
+	}
+
+	// verify: the logits of batch position i predict the token after it
+	llama_batch_clear(batch);
+	llama_batch_add(batch, s.last_token, s.n_past, {s.seq_id}, true);
+	for (size_t i = 0; i < draft.size(); i++) {
+		llama_batch_add(batch, draft[i], s.n_past + 1 + (llama_pos)i, {s.seq_id}, true);
+	}
+	if (llama_decode(ctx, batch) != 0) {
+		obs_log(LOG_ERROR, "%s: llama_decode() failed for a draft of %d tokens", __func__,
+			(int)draft.size());
+		release(s, INFERENCE_STOP_FAILED);
+		return true;
+	}
+	s.n_drafted += (int)draft.size();
+
+	for (size_t i = 0; i <= draft.size(); i++) {
+		const llama_token token = s.sampler->sample(llama_get_logits_ith(ctx, (int32_t)i));
+		s.n_past += 1;
+		if (!emit(s, token)) {
+			return true;
+		}
+		if (i == draft.size() || token != draft[i]) {
+			break;
+		}
+		s.n_draft_accepted += 1;
+	}
+
+	// drop the cells of the rejected draft tokens
+	llama_kv_cache_seq_rm(ctx, s.seq_id, s.n_past, -1);
+	return true;
+}
+
+// keep the conversation of a chat turn that was read completely in the chat sequence, in place
+// of the session parked there before. a turn that was reset meanwhile is forgotten.
+void inference_scheduler::park_session(slot &s)
+{
+	auto session = sessions.find(s.entry->job.session);
+	if (s.session_id == 0 || s.state != SLOT_GENERATE || session == sessions.end() ||
+	    session->second.id != s.session_id) {
+		return;
+	}
+	llama_kv_cache_seq_rm(ctx, chat_seq_id(), -1, -1);
+	llama_kv_cache_seq_cp(ctx, s.seq_id, chat_seq_id(), 0, s.n_past);
+	resident_session = session->first;
+	session->second.tokens.assign(s.tokens.begin(), s.tokens.begin() + s.n_past);
+}
+
+bool inference_scheduler::step()
+{
+	// a greedy request that generates alone is decoded speculatively with the draft model
+	if (draft_ctx != nullptr) {
+		slot *single = nullptr;
+		int n_active = 0;
+		for (slot &s : slots) {
+			if (s.state != SLOT_IDLE) {
+				n_active++;
+				single = s.state == SLOT_GENERATE ? &s : nullptr;
+			}
+		}
+		if (n_active == 1 && single != nullptr && single->sampler->is_greedy() &&
+		    speculate(*single)) {
+			return true;
+		}
+	}
+
+	llama_batch_clear(batch);
+
+	// the next token of every generating slot. with more slots than tokens in a batch they
+	// take turns, starting after the last one that got a token
+	std::vector<int> n_step(slots.size(), 0);
+	for (slot &s : slots) {
+		s.i_batch = -1;
+	}
+	const size_t n_slots = slots.size();
+	for (size_t k = 0; k < n_slots && batch.n_tokens < step_batch(); k++) {
+		const size_t i = (next_generate + k) % n_slots;
+		slot &s = slots[i];
+		if (s.state == SLOT_GENERATE) {
+			s.i_batch = batch.n_tokens;
+			llama_batch_add(batch, s.last_token, s.n_past, {s.seq_id}, true);
+			n_step[i] = 1;
+			next_generate = (i + 1) % n_slots;
+		}
+	}
+
+	// fill the rest of the batch with prompt chunks, interactive requests first
+	std::vector<size_t> prefilling;
+	for (size_t i = 0; i < slots.size(); i++) {
+		if (slots[i].state == SLOT_PREFILL) {
+			prefilling.push_back(i);
+		}
+	}
+	std::sort(prefilling.begin(), prefilling.end(), [this](size_t a, size_t b) {
+		return runs_before(slots[a].entry->job.priority, slots[a].entry->seq,
+				   slots[b].entry->job.priority, slots[b].entry->seq);
+	});
+	for (size_t i : prefilling) {
+		slot &s = slots[i];
+		const int n_chunk = std::min(step_batch() - batch.n_tokens,
+					     (int)(s.prompt.size() - s.n_prompt_done));
+		if (n_chunk <= 0) {
+			break;
+		}
+		for (int j = 0; j < n_chunk; j++) {
+			llama_batch_add(batch, s.prompt[s.n_prompt_done + j], s.n_past + j,
+					{s.seq_id}, false);
+		}
+		n_step[i] = n_chunk;
+		// llama_decode will output logits only for the last token of the prompt
+		if (s.n_prompt_done + n_chunk == s.prompt.size()) {
+			s.i_batch = batch.n_tokens - 1;
+			batch.logits[s.i_batch] = true;
+		}
+	}
+
+	if (batch.n_tokens == 0) {
+		return true;
+	}
+
+	if (llama_decode(ctx, batch) != 0) {
+		obs_log(LOG_ERROR, "%s: llama_decode() failed for a batch of %d tokens", __func__,
+			batch.n_tokens);
+		return false;
+	}
+
+	for (size_t i = 0; i < slots.size(); i++) {
+		slot &s = slots[i];
+		if (n_step[i] == 0) {
+			continue;
+		}
+		s.n_past += n_step[i];
+
+		if (s.state == SLOT_PREFILL) {
+			s.n_prompt_done += n_step[i];
+			const inference_job &job = s.entry->job;
+			if (job.prefill_progress_callback) {
+				const float t_elapsed =
+					(ggml_time_us() - s.t_start_us) / 1000000.0f;
+				job.prefill_progress_callback(
+					(int)s.n_prompt_done, (int)s.prompt.size(),
+					t_elapsed > 0.0f ? s.n_prompt_done / t_elapsed : 0.0f);
+			}
+			if (s.i_batch < 0) {
+				continue;
+			}
+			s.state = SLOT_GENERATE;
+			s.t_generate_us = ggml_time_us();
+		}
+
+		// sample the next token using the configured temperature, top-k and top-p
+		emit(s, s.sampler->sample(llama_get_logits_ith(ctx, s.i_batch)));
+	}
+
+	return true;
+}
+
+void inference_scheduler::worker()
+{
+	for (;;) {
+		std::vector<std::pair<slot *, std::unique_ptr<queued_job>>> admitted;
+		bool exit = false;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			const auto active = [this]() {
+				return std::any_of(slots.begin(), slots.end(), [](const slot &s) {
+					return s.state != SLOT_IDLE;
+				});
+			};
+			// background requests wait while OBS struggles
+			const auto deferred = [this](const inference_job &job) {
+				return throttle.defer_background &&
+				       job.priority == INFERENCE_PRIORITY_BACKGROUND;
+			};
+			const auto runnable = [this, &deferred]() {
+				for (const auto &entry : queue) {
+					if (!deferred(entry->job)) {
+						return true;
+					}
+				}
+				return false;
+			};
+			if (!active() && queue.empty() && idle_since == 0) {
+				idle_since = ggml_time_us();
+			}
+			cv.wait(lock, [this, &active, &runnable]() {
+				return stopping ||
+				       ((has_pending_ctx || has_pending_draft_ctx) && !active()) ||
+				       (ctx != nullptr && runnable()) || active();
+			});
+			exit = stopping;
+			step_throttle = throttle;
+
+			// switch contexts between requests
+			if (has_pending_ctx && !active()) {
+				pending_ctx_released.set_value(ctx);
+				ctx = pending_ctx;
+				pending_ctx = nullptr;
+				has_pending_ctx = false;
+				prefix_valid = false;
+				kv_shift = pending_kv_shift;
+				resident_session.clear();
+				resize(pending_n_batch, pending_n_parallel);
+				// core set and priority may have changed with the context
+				apply_inference_thread_policy();
+				if (ctx != nullptr) {
+					// one more sequence for the parked conversation
+					n_seq_ctx = (int)llama_n_ctx(ctx) / (int)(slots.size() + 1);
+					// the tokens of another model mean nothing
+					if (llama_get_model(ctx) != sessions_model) {
+						sessions.clear();
+						sessions_model = llama_get_model(ctx);
+					}
+				}
+			}
+
+			for (const std::string &name : session_resets) {
+				sessions.erase(name);
+				if (resident_session == name) {
+					if (ctx != nullptr) {
+						llama_kv_cache_seq_rm(ctx, chat_seq_id(), -1, -1);
+					}
+					resident_session.clear();
+				}
+			}
+			session_resets.clear();
+
+			if (has_pending_draft_ctx && !active()) {
+				pending_draft_ctx_released.set_value(draft_ctx);
+				draft_ctx = pending_draft_ctx;
+				pending_draft_ctx = nullptr;
+				has_pending_draft_ctx = false;
+				draft_tokens.clear();
+			}
+
+			// with more than one slot, background requests leave one slot free for the
+			// dock
+			const size_t max_background = std::max<size_t>(slots.size() - 1, 1);
+
+			// a chat session runs one turn at a time
+			const auto session_busy = [this, &admitted](const inference_job &job) {
+				if (job.session.empty()) {
+					return false;
+				}
+				for (const slot &s : slots) {
+					if (s.entry != nullptr &&
+					    s.entry->job.session == job.session) {
+						return true;
+					}
+				}
+				for (auto &a : admitted) {
+					if (a.second->job.session == job.session) {
+						return true;
+					}
+				}
+				return false;
+			};
+			// a pending context switch waits for the active requests to drain
+			while (!exit && ctx != nullptr && !has_pending_ctx && !queue.empty()) {
+				auto next = queue.end();
+				for (auto it = queue.begin(); it != queue.end(); ++it) {
+					if (!session_busy((*it)->job) && !deferred((*it)->job) &&
+					    (next == queue.end() ||
+					     runs_before((*it)->job.priority, (*it)->seq,
+							 (*next)->job.priority, (*next)->seq))) {
+						next = it;
+					}
+				}
+				if (next == queue.end()) {
+					break;
+				}
+				size_t n_background = 0;
+				slot *free_slot = nullptr;
+				for (slot &s : slots) {
+					if (s.state == SLOT_IDLE && s.entry == nullptr) {
+						free_slot = free_slot ? free_slot : &s;
+					} else if (s.entry != nullptr &&
+						   s.entry->job.priority ==
+							   INFERENCE_PRIORITY_BACKGROUND) {
+						n_background++;
+					}
+				}
+				for (auto &a : admitted) {
+					if (a.second->job.priority ==
+					    INFERENCE_PRIORITY_BACKGROUND) {
+						n_background++;
+					}
+				}
+				if (free_slot == nullptr ||
+				    ((*next)->job.priority == INFERENCE_PRIORITY_BACKGROUND &&
+				     n_background >= max_background)) {
+					break;
+				}
+				admitted.emplace_back(free_slot, std::move(*next));
+				queue.erase(next);
+				// reserve the slot until it is set up outside the lock
+				free_slot->state = SLOT_PREFILL;
+			}
+		}
+
+		for (auto &a : admitted) {
+			slot &s = *a.first;
+			s.state = SLOT_IDLE;
+			if (exit || *a.second->job.cancel || !admit(s, std::move(a.second))) {
+				const inference_stop_reason stop_reason =
+					a.second ? INFERENCE_STOP_CANCELLED : INFERENCE_STOP_FAILED;
+				std::unique_ptr<queued_job> entry =
+					a.second ? std::move(a.second) : std::move(s.entry);
+				s.state = SLOT_IDLE;
+				finish(*entry, stop_reason);
+			}
+		}
+
+		// cancelled requests leave their slot, with what was generated so far
+		for (slot &s : slots) {
+			if (s.state != SLOT_IDLE && (exit || *s.entry->job.cancel)) {
+				release(s, INFERENCE_STOP_CANCELLED);
+			}
+		}
+
+		if (exit) {
+			return;
+		}
+
+		if (!step()) {
+			// a failed decode leaves the KV cache of the batch in an unknown state
+			for (slot &s : slots) {
+				if (s.state != SLOT_IDLE) {
+					release(s, INFERENCE_STOP_FAILED);
+				}
+			}
+		}
+
+		// leave the GPU and CPU to OBS for a moment
+		if (step_throttle.step_pause_ms > 0) {
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait_for(lock, std::chrono::milliseconds(step_throttle.step_pause_ms),
+				    [this]() {
+					    return stopping || throttle.level < step_throttle.level;
+				    });
+		}
+	}
+}
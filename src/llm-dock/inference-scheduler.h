@@ -0,0 +1,333 @@
+#ifndef INFERENCE_SCHEDULER_H
+#define INFERENCE_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <llama.h>
+
+#include "inference-governor.h"
+
+// requests from the dock are served before background work such as workflows
+enum inference_priority {
+	INFERENCE_PRIORITY_BACKGROUND = 0,
+	INFERENCE_PRIORITY_INTERACTIVE = 1,
+};
+
+// what to do when a request is submitted to a full queue
+enum inference_queue_policy {
+	// refuse the new request
+	INFERENCE_QUEUE_REJECT,
+	// drop the oldest queued request of the lowest priority to make room
+	INFERENCE_QUEUE_DROP_OLDEST,
+};
+
+// why a request ended
+enum inference_stop_reason {
+	// the model generated the end of stream token
+	INFERENCE_STOP_EOS,
+	// a stop string or the end sequence matched
+	INFERENCE_STOP_STRING,
+	// the generation reached max_output_tokens or the sequence reached the context length
+	INFERENCE_STOP_LENGTH,
+	// cancelled while queued or running
+	INFERENCE_STOP_CANCELLED,
+	// dropped from a full queue
+	INFERENCE_STOP_DROPPED,
+	// the prompt did not fit or decoding failed
+	INFERENCE_STOP_FAILED,
+};
+
+// timings and counters of one finished request
+struct inference_metrics {
+	inference_priority priority = INFERENCE_PRIORITY_INTERACTIVE;
+	inference_stop_reason stop_reason = INFERENCE_STOP_CANCELLED;
+	// time from submit() until a slot picked the request up
+	double queue_wait_ms = 0.0;
+	double tokenize_ms = 0.0;
+	// time to decode the prompt, including the shared prefix when it had to be decoded
+	double prefill_ms = 0.0;
+	// time from submit() until the first token was sampled
+	double ttft_ms = 0.0;
+	double decode_ms = 0.0;
+	int n_prompt = 0;
+	// prompt tokens reused from the cached prefix
+	int n_cached = 0;
+	int n_generated = 0;
+	// tokens proposed by the draft model and how many of them the model accepted
+	int n_drafted = 0;
+	int n_draft_accepted = 0;
+	float decode_tokens_per_second = 0.0f;
+	// KV cells in use by all sequences when the request finished
+	int kv_cells_used = 0;
+};
+
+// set to true to cancel a queued or running request
+typedef std::shared_ptr<std::atomic<bool>> cancellation_token;
+
+cancellation_token make_cancellation_token();
+
+struct llm_config_data;
+
+struct inference_job {
+	std::string prompt;
+	// name of the chat session the prompt continues, empty for a request without history.
+	// the earlier turns of the session stay in the KV cache, so only the new turn is decoded.
+	std::string session;
+	inference_priority priority = INFERENCE_PRIORITY_INTERACTIVE;
+	cancellation_token cancel;
+	// settings the request runs with, llm_config_snapshot() at submit() if not set
+	std::shared_ptr<const llm_config_data> config;
+	// called from the inference thread for every generated piece
+	std::function<void(const std::string &)> partial_generation_callback;
+	// called from the inference thread for every sampled token, before stop sequence matching
+	std::function<void(llama_token)> token_callback;
+	// called from the inference thread with (tokens done, tokens total, tokens/s) of the
+	// prefill
+	std::function<void(int, int, float)> prefill_progress_callback;
+	// called from the inference thread with the full generation and why it ended, also when
+	// the request was cancelled, dropped or failed (then with what was generated so far,
+	// possibly empty)
+	std::function<void(const std::string &, inference_stop_reason)> done_callback;
+};
+
+class llama_sampler;
+class stop_matcher;
+
+/**
+  * @brief Runs all inference requests for one llama_context on a single worker thread.
+  * Requests wait in a bounded queue ordered by priority and then by submission order, so only
+  * the worker thread ever touches the context and its KV cache.
+  * Up to n_parallel requests are decoded together (continuous batching): every active request
+  * owns a slot with its own sequence id, sampler and stop matcher, and each llama_decode call
+  * carries the next token of every generating slot plus prompt chunks of newly admitted ones.
+  * When more slots generate than fit into n_batch, they take turns.
+  * Sequence 0 holds the prompt template prefix, which slots share by copying it into their own
+  * sequence. Finished slots free their KV cells and queued requests join on the next step.
+  * The scheduler can be created before the model is loaded: requests stay queued until a
+  * context is handed over with set_context().
+  * With a draft context, a request that generates alone with greedy sampling is decoded
+  * speculatively: the draft model proposes n_draft tokens, one decode of the model verifies
+  * them all and the tokens up to the first mismatch are kept, so the output is the same as
+  * without the draft model.
+  * A generation that fills its sequence either ends or, with context_shift, drops the older
+  * half of the tokens after the prompt template prefix and moves the rest down in the KV cache,
+  * so it continues without decoding anything again.
+  * Chat sessions keep the tokens of their conversation. The conversation of the session that
+  * ran last is parked in its own sequence between turns, so its next turn only decodes the new
+  * message. Other sessions decode their history again once when they continue.
+  * While OBS struggles the scheduler is throttled: background requests stay queued, decode
+  * steps get smaller and the worker pauses between them.
+  */
+class inference_scheduler {
+public:
+	inference_scheduler(struct llama_context *ctx, int n_batch, int n_parallel,
+			    size_t max_queue = 8,
+			    inference_queue_policy policy = INFERENCE_QUEUE_DROP_OLDEST);
+	~inference_scheduler();
+
+	// hand a context (or nullptr to detach) to the worker thread, which switches once no
+	// request is active. n_batch and n_parallel are applied with the switch, 0 keeps the
+	// current value. kv_shift is false for a context whose KV cells cannot be shifted, e.g.
+	// with a quantized K cache. the future resolves to the context the scheduler no longer
+	// uses, which the caller may then free.
+	std::future<struct llama_context *> set_context(struct llama_context *ctx, int n_batch = 0,
+							 int n_parallel = 0, bool kv_shift = true);
+
+	// hand a draft context for speculative decoding (or nullptr to detach) to the worker
+	// thread, which switches once no request is active. its model must share the vocabulary
+	// of the context's model, it is not used otherwise. the future resolves to the draft
+	// context the scheduler no longer uses.
+	std::future<struct llama_context *> set_draft_context(struct llama_context *draft_ctx);
+
+	// called from submit() when a request is queued while no context is attached or the
+	// context is being detached, e.g. to reload an unloaded model
+	void set_wakeup_callback(std::function<void()> callback);
+
+	// time (ggml_time_us) since when no request is queued or running, 0 while busy
+	int64_t idle_since_us();
+
+	// called with the metrics of every request that finished, also dropped and cancelled ones,
+	// from the thread that finished it (usually the inference thread)
+	void set_metrics_callback(std::function<void(const inference_metrics &)> callback);
+
+	// called from the inference thread before the prompt template prefix is decoded into
+	// sequence 0 (load, true if it restored the state of the prefix tokens instead) and after
+	// it was decoded (save). only called while no other sequence is in the KV cache, as the
+	// state covers the whole context.
+	void set_prefix_state_callbacks(
+		std::function<bool(struct llama_context *, const std::vector<llama_token> &)> load,
+		std::function<void(struct llama_context *, const std::vector<llama_token> &)> save);
+
+	// queue a request. the future resolves to the generated text, or to an empty string if the
+	// request was rejected, dropped or cancelled before it started.
+	std::future<std::string> submit(inference_job job);
+
+	// number of requests waiting in the queue
+	size_t queued();
+
+	// drop all queued requests, e.g. when the model failed to load
+	void cancel_queued();
+
+	// forget the conversation of a chat session
+	void reset_session(const std::string &name);
+
+	// hold back inference from now on, see inference_governor
+	void set_throttle(const inference_throttle &throttle);
+
+	// cancel all requests and join the worker thread. context switches requested later, or
+	// still pending, happen at once.
+	void stop();
+
+private:
+	struct queued_job {
+		inference_job job;
+		uint64_t seq;
+		int64_t t_submit_us = 0;
+		std::promise<std::string> result;
+	};
+
+	enum slot_state {
+		SLOT_IDLE,
+		SLOT_PREFILL,
+		SLOT_GENERATE,
+	};
+
+	struct chat_session {
+		uint64_t id = 0;
+		// the conversation so far, prompt template prefix included
+		std::vector<llama_token> tokens;
+	};
+
+	struct slot {
+		llama_seq_id seq_id;
+		slot_state state = SLOT_IDLE;
+		std::unique_ptr<queued_job> entry;
+		// prompt tokens and how many of them are in the KV cache
+		std::vector<llama_token> prompt;
+		size_t n_prompt_done = 0;
+		// next position in the sequence
+		int n_past = 0;
+		// token sampled last, to be decoded in the next step
+		llama_token last_token = 0;
+		// index of the logits of this slot in the current batch, -1 if none
+		int i_batch = -1;
+		int n_decoded = 0;
+		// prompt tokens reused from sequence 0
+		int n_cached = 0;
+		// tokens at the start of the sequence (the prompt template prefix) that are kept
+		// when the context is shifted
+		int n_keep = 0;
+		// max. generated tokens, 0 for no limit but the context
+		int n_max_output = 0;
+		int n_shifted = 0;
+		// chat_session::id of the session the request continues, 0 if none
+		uint64_t session_id = 0;
+		int64_t t_start_us = 0;
+		int64_t t_tokenize_us = 0;
+		int64_t t_generate_us = 0;
+		// all tokens of the sequence including the last sampled one, for the draft model
+		std::vector<llama_token> tokens;
+		int n_drafted = 0;
+		int n_draft_accepted = 0;
+		std::string output;
+		std::unique_ptr<llama_sampler> sampler;
+		std::unique_ptr<stop_matcher> stop;
+	};
+
+	void worker();
+	bool admit(slot &s, std::unique_ptr<queued_job> entry);
+	void resize(int n_batch, int n_parallel);
+	void switch_stopped();
+	bool prepare_prefix(const std::string &prefix, const inference_job &job);
+	bool step();
+	bool speculate(slot &s);
+	bool emit(slot &s, llama_token token);
+	// max. tokens of the next decode
+	int step_batch() const
+	{
+		return step_throttle.max_batch_tokens > 0
+			       ? std::min(n_batch, step_throttle.max_batch_tokens)
+			       : n_batch;
+	}
+	bool shift_context(slot &s, int n_discard);
+	void park_session(slot &s);
+	// holds the conversation of resident_session between its turns
+	llama_seq_id chat_seq_id() const { return (llama_seq_id)(slots.size() + 1); }
+	void release(slot &s, inference_stop_reason stop_reason);
+	void finish(queued_job &entry, const std::string &output, const inference_metrics &metrics);
+	void finish(queued_job &entry, inference_stop_reason stop_reason);
+
+	// owned by the worker thread, nullptr until a context was handed over
+	struct llama_context *ctx = nullptr;
+	int n_batch;
+	// max. tokens of one sequence, the context is split evenly between the slots
+	int n_seq_ctx = 0;
+	// whether shift_context() may move KV cells of ctx
+	bool kv_shift = true;
+	size_t max_queue;
+	inference_queue_policy policy;
+
+	// owned by the worker thread
+	llama_batch batch;
+	std::vector<slot> slots;
+	// prompt template prefix decoded into sequence 0
+	std::string prefix_text;
+	std::vector<llama_token> prefix_tokens;
+	bool prefix_valid = false;
+	// chat sessions by name
+	std::map<std::string, chat_session> sessions;
+	uint64_t next_session_id = 0;
+	// the model the session tokens belong to
+	const struct llama_model *sessions_model = nullptr;
+	// session parked in chat_seq_id(), empty if none
+	std::string resident_session;
+	// first slot to get a token in the next step, when not all generating slots fit
+	size_t next_generate = 0;
+	// throttle of the current step, copied from throttle under the lock
+	inference_throttle step_throttle;
+	// draft model context, sequence 0 holds draft_tokens
+	struct llama_context *draft_ctx = nullptr;
+	std::vector<llama_token> draft_tokens;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<std::unique_ptr<queued_job>> queue;
+	std::vector<std::string> session_resets;
+	inference_throttle throttle;
+	struct llama_context *pending_ctx = nullptr;
+	bool has_pending_ctx = false;
+	int pending_n_batch = 0;
+	int pending_n_parallel = 0;
+	bool pending_kv_shift = true;
+	std::promise<struct llama_context *> pending_ctx_released;
+	struct llama_context *pending_draft_ctx = nullptr;
+	bool has_pending_draft_ctx = false;
+	std::promise<struct llama_context *> pending_draft_ctx_released;
+	// the context requests will run on once pending switches are done
+	struct llama_context *target_ctx = nullptr;
+	std::function<void()> wakeup_callback;
+	std::function<void(const inference_metrics &)> metrics_callback;
+	std::function<bool(struct llama_context *, const std::vector<llama_token> &)>
+		prefix_state_load;
+	std::function<void(struct llama_context *, const std::vector<llama_token> &)>
+		prefix_state_save;
+	int64_t idle_since = 0;
+	uint64_t next_seq = 0;
+	bool stopping = false;
+	// the worker thread was joined
+	bool stopped = false;
+	std::thread thread;
+};
+
+#endif // INFERENCE_SCHEDULER_H
@@ -1,7 +1,10 @@
 
 #include "llama-inference.h"
+#include "llama-sampler.h"
 #include "plugin-support.h"
 #include "llm-config-data.h"
+#include "thread-policy.h"
+#include "memory-budget.h"
 
 #include <obs-module.h>
 
@@ -9,8 +12,10 @@
 #include <future>
 #include <string>
 #include <algorithm>
+#include <filesystem>
 #include <sstream>
 #include <cmath>
+#include <thread>
 
 std::string replace(const std::string &s, const std::string &from, const std::string &to)
 {
@@ -23,6 +28,16 @@ std::string replace(const std::string &s, const std::string &from, const std::st
 	return result;
 }
 
+llama_sampler_params llama_sampler_params_from_config(const llm_config_data &config)
+{
+	llama_sampler_params params;
+	params.temperature = config.temperature;
+	params.top_k = config.top_k;
+	params.top_p = config.top_p;
+	params.repeat_penalty = config.repeat_penalty;
+	return params;
+}
+
 std::string get_system_info(const llama_context_params &params)
 {
 	std::ostringstream os;
@@ -53,7 +68,7 @@ void llama_batch_add(struct llama_batch &batch, llama_token id, llama_pos pos,
 }
 
 std::vector<llama_token> llama_tokenize(const struct llama_model *model, const std::string &text,
-					bool add_bos, bool special = false)
+					bool add_bos, bool special)
 {
 	// upper limit for the number of tokens
 	int n_tokens = (int)text.length() + (add_bos ? 1 : 0);
@@ -72,7 +87,7 @@ std::vector<llama_token> llama_tokenize(const struct llama_model *model, const s
 }
 
 std::vector<llama_token> llama_tokenize(const struct llama_context *ctx, const std::string &text,
-					bool add_bos, bool special = false)
+					bool add_bos, bool special)
 {
 	return llama_tokenize(llama_get_model(ctx), text, add_bos, special);
 }
@@ -94,12 +109,64 @@ std::string llama_token_to_piece(const struct llama_context *ctx, llama_token to
 	return std::string(result.data(), result.size());
 }
 
-struct llama_context *llama_init_context(const std::string &model_file_path)
+bool llama_prefill(struct llama_context *ctx, llama_batch &batch, int n_batch,
+		   const std::vector<llama_token> &tokens, int n_past, llama_seq_id seq_id,
+		   bool last_logits, std::function<bool()> should_stop,
+		   std::function<void(int, int, float)> progress_callback)
+{
+	const int n_tokens = (int)tokens.size();
+	const auto t_start = ggml_time_us();
+
+	for (int i = 0; i < n_tokens; i += n_batch) {
+		if (should_stop && should_stop()) {
+			obs_log(LOG_INFO, "%s: prefill cancelled after %d / %d tokens", __func__, i,
+				n_tokens);
+			return false;
+		}
+
+		const int n_chunk = std::min(n_batch, n_tokens - i);
+
+		llama_batch_clear(batch);
+		for (int j = 0; j < n_chunk; j++) {
+			llama_batch_add(batch, tokens[i + j], (llama_pos)(n_past + i + j), {seq_id},
+					false);
+		}
+
+		// llama_decode will output logits only for the last token of the prompt
+		if (last_logits && i + n_chunk == n_tokens) {
+			batch.logits[batch.n_tokens - 1] = true;
+		}
+
+		if (llama_decode(ctx, batch) != 0) {
+			obs_log(LOG_ERROR, "%s: llama_decode() failed at token %d / %d", __func__,
+				i, n_tokens);
+			return false;
+		}
+
+		if (progress_callback) {
+			const float t_elapsed = (ggml_time_us() - t_start) / 1000000.0f;
+			progress_callback(i + n_chunk, n_tokens,
+					  t_elapsed > 0.0f ? (i + n_chunk) / t_elapsed : 0.0f);
+		}
+	}
+
+	return true;
+}
+
+struct llama_model *llama_load_model(const std::string &model_file_path,
+				     const llm_config_data &config,
+				     llama_progress_callback progress_callback,
+				     void *progress_callback_user_data)
 {
 	llama_backend_init(true);
 
-	// initialize the model
+	// initialize the model. mmap'd weights are read back from the page cache when a model
+	// that was freed is loaded again
 	struct llama_model_params mparams = llama_model_default_params();
+	mparams.use_mmap = config.use_mmap;
+	mparams.use_mlock = config.use_mlock;
+	mparams.progress_callback = progress_callback;
+	mparams.progress_callback_user_data = progress_callback_user_data;
 
 	struct llama_model *model_llama =
 		llama_load_model_from_file(model_file_path.c_str(), mparams);
@@ -114,8 +181,50 @@ struct llama_context *llama_init_context(const std::string &model_file_path)
 	llama_model_desc(model_llama, model_desc, sizeof(model_desc));
 	obs_log(LOG_INFO, "%s: model_desc = %s", __func__, model_desc);
 
-	// initialize the context
+	return model_llama;
+}
+
+std::string llama_model_file_id(const std::string &model_file_path)
+{
+	const std::filesystem::path path = std::filesystem::u8path(model_file_path);
+	std::error_code ec;
+	const uintmax_t size = std::filesystem::file_size(path, ec);
+	if (ec) {
+		return model_file_path;
+	}
+	const std::filesystem::file_time_type time = std::filesystem::last_write_time(path, ec);
+	return model_file_path + "|" + std::to_string(size) + "|" +
+	       std::to_string(ec ? 0 : (int64_t)time.time_since_epoch().count());
+}
+
+struct llama_context *llama_init_context(struct llama_model *model_llama,
+					 const llm_config_data &config, int n_ctx, int n_threads)
+{
+	// initialize the context, with room for the parallel sequences of the scheduler and the
+	// parked chat conversation
 	struct llama_context_params lparams = llama_context_default_params();
+	lparams.n_ctx = n_ctx > 0 ? (uint32_t)n_ctx
+				  : (uint32_t)((std::max(config.n_parallel, 1) + 1) *
+					       std::max(config.n_ctx, 64));
+	lparams.n_batch = (uint32_t)std::max(config.n_batch, 1);
+	// this llama.cpp can only quantize the K cache, the V cache stays f16
+	lparams.type_k = llm_kv_cache_type(config.kv_cache_type);
+
+	// requested threads first, then the configured ones and the tuned count, never more than
+	// the cores inference may run on
+	const int n_cores = inference_core_count(config);
+	const bool threads_requested = n_threads > 0;
+	if (!threads_requested) {
+		n_threads = config.n_threads > 0 ? config.n_threads
+						 : global_llm_context.n_threads_tuned;
+	}
+	lparams.n_threads = (uint32_t)std::min(n_threads > 0 ? n_threads : (int)lparams.n_threads,
+					       n_cores);
+	int n_threads_batch = config.n_threads_batch > 0 && !threads_requested
+				      ? config.n_threads_batch
+				      : n_threads;
+	lparams.n_threads_batch = (uint32_t)std::min(
+		n_threads_batch > 0 ? n_threads_batch : (int)lparams.n_threads_batch, n_cores);
 
 	struct llama_context *ctx_llama = llama_new_context_with_model(model_llama, lparams);
 
@@ -126,153 +235,83 @@ struct llama_context *llama_init_context(const std::string &model_file_path)
 
 	if (llama_get_model(ctx_llama) == nullptr) {
 		obs_log(LOG_ERROR, "%s: error: failed to get model from llama_context", __func__);
+		llama_free(ctx_llama);
 		return nullptr;
 	}
 
 	obs_log(LOG_INFO, "%s", get_system_info(lparams).c_str());
 
-	// Warm up in another thread
-	std::thread t([ctx_llama, lparams]() {
-		obs_log(LOG_INFO, "warming up the model with an empty run");
-
-		std::vector<llama_token> tokens_list = {
-			llama_token_bos(llama_get_model(ctx_llama)),
-			llama_token_eos(llama_get_model(ctx_llama)),
-		};
-
-		llama_decode(ctx_llama, llama_batch_get_one(tokens_list.data(),
-							    (int)std::min(tokens_list.size(),
-									  (size_t)lparams.n_batch),
-							    0, 0));
-		llama_kv_cache_clear(ctx_llama);
-		llama_reset_timings(ctx_llama);
-
-		obs_log(LOG_INFO, "warmed up the model");
-	});
-	t.detach();
-
 	return ctx_llama;
 }
 
-std::string llama_inference(const std::string &promptIn, struct llama_context *ctx,
-			    std::function<void(const std::string &)> partial_generation_callback,
-                std::function<bool(const std::string &)> should_stop_callback)
+void llama_warmup_context(struct llama_context *ctx_llama)
 {
-	std::string output = "";
-
-	// tokenize the prompt
-	// replace {0} in the system prompt with the prompt
-	std::string prompt = replace(global_llm_config.system_prompt, "{0}", promptIn);
+	obs_log(LOG_INFO, "warming up the model with an empty run");
 
-	std::vector<llama_token> tokens_list;
-	tokens_list = ::llama_tokenize(ctx, prompt, true);
+	std::vector<llama_token> tokens_list = {
+		llama_token_bos(llama_get_model(ctx_llama)),
+		llama_token_eos(llama_get_model(ctx_llama)),
+	};
 
-	// total length of the sequence including the prompt
-	const int n_len = 512;
+	llama_decode(ctx_llama,
+		     llama_batch_get_one(tokens_list.data(), (int)tokens_list.size(), 0, 0));
+	llama_kv_cache_clear(ctx_llama);
+	llama_reset_timings(ctx_llama);
 
-	const int n_ctx = llama_n_ctx(ctx);
-	const int n_kv_req = (int)(tokens_list.size() + (n_len - tokens_list.size()));
-
-	obs_log(LOG_INFO, "%s: n_len = %d, n_ctx = %d, n_kv_req = %d", __func__, n_len, n_ctx,
-		n_kv_req);
+	obs_log(LOG_INFO, "warmed up the model");
+}
 
-	// make sure the KV cache is big enough to hold all the prompt and generated tokens
-	if (n_kv_req > n_ctx) {
-		obs_log(LOG_INFO,
-			"%s: error: n_kv_req > n_ctx, the required KV cache size is not big enough",
-			__func__);
-		obs_log(LOG_INFO, "%s:        either reduce n_parallel or increase n_ctx",
-			__func__);
-		return "";
+int llama_tune_threads(struct llama_model *model, int max_threads)
+{
+	const int n_tokens = 16;
+	std::vector<int> candidates;
+	for (int n = 1; n < max_threads; n = n < 4 ? n + 1 : n + n / 2) {
+		candidates.push_back(n);
 	}
+	candidates.push_back(std::max(max_threads, 1));
+
+	std::vector<std::pair<int, float>> results;
+	for (int n_threads : candidates) {
+		struct llama_context_params lparams = llama_context_default_params();
+		lparams.n_ctx = n_tokens + 8;
+		lparams.n_batch = 1;
+		lparams.n_threads = (uint32_t)n_threads;
+		lparams.n_threads_batch = (uint32_t)n_threads;
+		struct llama_context *ctx = llama_new_context_with_model(model, lparams);
+		if (ctx == nullptr) {
+			continue;
+		}
 
-	// create a llama_batch with size 512
-	// we use this object to submit token data for decoding
-
-	llama_batch batch = llama_batch_init(512, 0, 1);
-
-	// evaluate the initial prompt
-	for (size_t i = 0; i < tokens_list.size(); i++) {
-		llama_batch_add(batch, tokens_list[i], (llama_pos)i, {0}, false);
+		llama_token token = llama_token_bos(model);
+		// the first decode allocates, keep it out of the measurement
+		bool ok = llama_decode(ctx, llama_batch_get_one(&token, 1, 0, 0)) == 0;
+		const int64_t t_start_us = ggml_time_us();
+		for (int i = 1; ok && i <= n_tokens; i++) {
+			ok = llama_decode(ctx, llama_batch_get_one(&token, 1, i, 0)) == 0;
+		}
+		const int64_t t_us = ggml_time_us() - t_start_us;
+		llama_free(ctx);
+
+		if (ok && t_us > 0) {
+			const float tokens_per_second = n_tokens * 1000000.0f / t_us;
+			obs_log(LOG_INFO, "%s: %d threads: %.1f tokens/s", __func__, n_threads,
+				tokens_per_second);
+			results.push_back({n_threads, tokens_per_second});
+		}
 	}
-
-	// llama_decode will output logits only for the last token of the prompt
-	batch.logits[batch.n_tokens - 1] = true;
-
-	if (llama_decode(ctx, batch) != 0) {
-		obs_log(LOG_INFO, "%s: llama_decode() failed\n", __func__);
-		return "";
+	if (results.empty()) {
+		return 0;
 	}
 
-	// main loop
-
-	int n_cur = batch.n_tokens;
-	int n_decode = 0;
-
-	const auto t_main_start = ggml_time_us();
-
-	while (n_cur <= n_len) {
-		// sample the next token
-		{
-			auto n_vocab = llama_n_vocab(llama_get_model(ctx));
-			auto *logits = llama_get_logits_ith(ctx, batch.n_tokens - 1);
-
-			std::vector<llama_token_data> candidates;
-			candidates.reserve(n_vocab);
-
-			for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-				candidates.emplace_back(
-					llama_token_data{token_id, logits[token_id], 0.0f});
-			}
-
-			llama_token_data_array candidates_p = {candidates.data(), candidates.size(),
-							       false};
-
-			// sample the most likely token
-			const llama_token new_token_id =
-				llama_sample_token_greedy(ctx, &candidates_p);
-
-			// is it an end of stream?
-			if (new_token_id == llama_token_eos(llama_get_model(ctx)) ||
-			    n_cur == n_len) {
-				break;
-			}
-
-            std::string piece = llama_token_to_piece(ctx, new_token_id);
-			partial_generation_callback(piece);
-            output += piece;
-
-			// prepare the next batch
-			llama_batch_clear(batch);
-
-			// push this new token for next evaluation
-			llama_batch_add(batch, new_token_id, n_cur, {0}, true);
-
-			n_decode += 1;
-		}
-
-		n_cur += 1;
-
-		// evaluate the current batch with the transformer model
-		if (llama_decode(ctx, batch)) {
-			obs_log(LOG_ERROR, "%s : failed to eval, return code %d", __func__, 1);
-			return "";
+	float best = 0.0f;
+	for (const auto &r : results) {
+		best = std::max(best, r.second);
+	}
+	for (const auto &r : results) {
+		if (r.second >= 0.9f * best) {
+			obs_log(LOG_INFO, "%s: using %d threads", __func__, r.first);
+			return r.first;
 		}
-
-        if (should_stop_callback(output)) {
-            break;
-        }
 	}
-
-	// reset the KV cache
-	llama_kv_cache_clear(ctx);
-	llama_reset_timings(ctx);
-
-	const auto t_main_end = ggml_time_us();
-
-	obs_log(LOG_INFO, "%s: decoded %d tokens in %.2f s, speed: %.2f t/s", __func__, n_decode,
-		(t_main_end - t_main_start) / 1000000.0f,
-		n_decode / ((t_main_end - t_main_start) / 1000000.0f));
-
-	return output;
+	return results.back().first;
 }
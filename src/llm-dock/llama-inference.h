@@ -2,9 +2,54 @@
 
 #include <string>
 #include <functional>
+#include <vector>
 
-struct llama_context *llama_init_context(const std::string &model_file_path);
+std::string replace(const std::string &s, const std::string &from, const std::string &to);
 
-std::string llama_inference(const std::string &prompt, struct llama_context *ctx,
-			    std::function<void(const std::string &)> partial_generation_callback,
-                std::function<bool(const std::string &)> should_stop_callback);
+void llama_batch_clear(struct llama_batch &batch);
+
+void llama_batch_add(struct llama_batch &batch, llama_token id, llama_pos pos,
+		     const std::vector<llama_seq_id> &seq_ids, bool logits);
+
+std::vector<llama_token> llama_tokenize(const struct llama_context *ctx, const std::string &text,
+					bool add_bos, bool special = false);
+
+std::string llama_token_to_piece(const struct llama_context *ctx, llama_token token);
+
+struct llm_config_data;
+
+// load the model with the mmap and mlock options of config, reporting the load progress (0..1)
+struct llama_model *llama_load_model(const std::string &model_file_path,
+				     const llm_config_data &config,
+				     llama_progress_callback progress_callback = nullptr,
+				     void *progress_callback_user_data = nullptr);
+
+// identifies a model file by its path, size and modification time, hashing gigabytes of
+// weights would cost more than most of what the identity is used for
+std::string llama_model_file_id(const std::string &model_file_path);
+
+// create a context for a loaded model with the batch size and cache type of config, n_ctx
+// tokens or room for the parallel sequences of the scheduler when 0, and n_threads threads or
+// the configured ones when 0. contexts of the same model share its weights.
+struct llama_context *llama_init_context(struct llama_model *model, const llm_config_data &config,
+					 int n_ctx = 0, int n_threads = 0);
+
+// run an empty decode so the first request does not pay for the lazy initialization
+void llama_warmup_context(struct llama_context *ctx);
+
+// measure single token generation speed at several thread counts and return the smallest count
+// within 10% of the fastest one. adding threads past that point mostly takes cores from OBS.
+int llama_tune_threads(struct llama_model *model, int max_threads);
+
+struct llama_sampler_params;
+
+// sampling parameters of the settings
+llama_sampler_params llama_sampler_params_from_config(const llm_config_data &config);
+
+// Decode the prompt tokens at positions n_past... of sequence seq_id in chunks of at most
+// n_batch tokens. should_stop is checked between chunks and progress_callback receives
+// (tokens done, tokens total, tokens/s) after each chunk. Returns false on failure or cancel.
+bool llama_prefill(struct llama_context *ctx, llama_batch &batch, int n_batch,
+		   const std::vector<llama_token> &tokens, int n_past, llama_seq_id seq_id,
+		   bool last_logits, std::function<bool()> should_stop = nullptr,
+		   std::function<void(int, int, float)> progress_callback = nullptr);
@@ -0,0 +1,133 @@
+#include "llama-sampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+// candidates sorted first when top-p runs without top-k, doubled until the nucleus is sorted
+static const int TOP_P_MIN_SORTED = 64;
+
+llama_sampler::llama_sampler(const struct llama_model *model_,
+			     const llama_sampler_params &params_)
+	: model(model_), n_vocab(llama_n_vocab(model_))
+{
+	candidates.resize(n_vocab);
+	reset(params_);
+}
+
+void llama_sampler::reset(const llama_sampler_params &params_)
+{
+	params = params_;
+	last_tokens.clear();
+	last_tokens.reserve(std::max(params.repeat_last_n, 0));
+	penalty_scratch.reserve(std::max(params.repeat_last_n, 0));
+	last_tokens_pos = 0;
+	rng.seed(params.seed != 0 ? params.seed : std::random_device{}());
+}
+
+void llama_sampler::accept(llama_token token)
+{
+	if (params.repeat_last_n <= 0) {
+		return;
+	}
+	if (last_tokens.size() < (size_t)params.repeat_last_n) {
+		last_tokens.push_back(token);
+	} else {
+		last_tokens[last_tokens_pos] = token;
+		last_tokens_pos = (last_tokens_pos + 1) % last_tokens.size();
+	}
+}
+
+llama_token llama_sampler::sample(float *logits)
+{
+	// repetition penalty, applied once per distinct token in the history
+	if (params.repeat_penalty != 1.0f && !last_tokens.empty()) {
+		penalty_scratch.assign(last_tokens.begin(), last_tokens.end());
+		std::sort(penalty_scratch.begin(), penalty_scratch.end());
+		auto last = std::unique(penalty_scratch.begin(), penalty_scratch.end());
+		for (auto it = penalty_scratch.begin(); it != last; ++it) {
+			float &logit = logits[*it];
+			logit = logit <= 0.0f ? logit * params.repeat_penalty
+					      : logit / params.repeat_penalty;
+		}
+	}
+
+	// greedy: a single max pass over the logits
+	if (params.temperature <= 0.0f) {
+		return (llama_token)(std::max_element(logits, logits + n_vocab) - logits);
+	}
+
+	for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+		candidates[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
+	}
+
+	// sort candidates [begin, end) of the unsorted rest, so the first end candidates are the
+	// most likely ones in order
+	const auto by_logit = [](const llama_token_data &a, const llama_token_data &b) {
+		return a.logit > b.logit;
+	};
+	const auto sort_head = [this, &by_logit](int begin, int end) {
+		if (end < n_vocab) {
+			std::nth_element(candidates.begin() + begin, candidates.begin() + end,
+					 candidates.end(), by_logit);
+		}
+		std::sort(candidates.begin() + begin, candidates.begin() + end, by_logit);
+	};
+
+	// top-k: partial selection, only the k kept candidates get sorted
+	int n_keep = n_vocab;
+	int n_sorted = 0;
+	if (params.top_k > 0) {
+		n_keep = std::min(params.top_k, n_vocab);
+		sort_head(0, n_keep);
+		n_sorted = n_keep;
+	}
+
+	// softmax with temperature over the kept candidates, unsorted ones need a pass for the max
+	float max_logit = candidates[0].logit;
+	if (n_sorted == 0) {
+		for (int i = 1; i < n_keep; i++) {
+			max_logit = std::max(max_logit, candidates[i].logit);
+		}
+	}
+	float sum = 0.0f;
+	for (int i = 0; i < n_keep; i++) {
+		candidates[i].p = expf((candidates[i].logit - max_logit) / params.temperature);
+		sum += candidates[i].p;
+	}
+
+	// top-p: cut the tail once the cumulative probability reaches top_p. without top-k the
+	// candidates are sorted in growing parts while scanning, the nucleus is rarely more than
+	// a few hundred tokens of the vocabulary.
+	if (params.top_p < 1.0f) {
+		float cum = 0.0f;
+		for (int i = 0; i < n_keep; i++) {
+			if (i == n_sorted) {
+				const int n_head =
+					std::min(std::max(2 * n_sorted, TOP_P_MIN_SORTED), n_keep);
+				sort_head(n_sorted, n_head);
+				n_sorted = n_head;
+			}
+			cum += candidates[i].p / sum;
+			if (cum >= params.top_p) {
+				n_keep = i + 1;
+				break;
+			}
+		}
+		sum = 0.0f;
+		for (int i = 0; i < n_keep; i++) {
+			sum += candidates[i].p;
+		}
+	}
+
+	// the pick scans the kept candidates in any order, without top-k and top-p they stay
+	// unsorted
+	std::uniform_real_distribution<float> dist(0.0f, sum);
+	float r = dist(rng);
+	for (int i = 0; i < n_keep; i++) {
+		r -= candidates[i].p;
+		if (r <= 0.0f) {
+			return candidates[i].id;
+		}
+	}
+	return candidates[n_keep - 1].id;
+}
@@ -0,0 +1,62 @@
+#ifndef LLAMA_SAMPLER_H
+#define LLAMA_SAMPLER_H
+
+#include <llama.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+struct llama_sampler_params {
+	// temperature, <= 0 means greedy sampling
+	float temperature = 0.9f;
+	// keep only the k most likely tokens, <= 0 means the whole vocabulary
+	int top_k = 40;
+	// keep the smallest set of tokens whose probabilities add up to top_p, 1 disables
+	float top_p = 0.95f;
+	// penalty for tokens that appeared in the last repeat_last_n tokens, 1 disables
+	float repeat_penalty = 1.1f;
+	int repeat_last_n = 64;
+	// random seed, 0 picks a random one
+	uint32_t seed = 0;
+};
+
+/**
+  * @brief Token sampler that owns all of its buffers.
+  * The candidates buffer is allocated once for the vocabulary of the model and reused for every
+  * token, and top-k is selected with a partial sort, so sampling does not allocate. Without
+  * top-k the vocabulary is not sorted, top-p sorts only as many candidates as its nucleus
+  * needs.
+  */
+class llama_sampler {
+public:
+	llama_sampler(const struct llama_model *model, const llama_sampler_params &params);
+
+	// set new sampling parameters and clear the token history
+	void reset(const llama_sampler_params &params);
+
+	// add a token to the history used for the repetition penalty
+	void accept(llama_token token);
+
+	// sample the next token from the logits of one position. the repetition penalty is applied
+	// to the logits in place.
+	llama_token sample(float *logits);
+
+	const struct llama_model *get_model() const { return model; }
+
+	// the most likely token is always picked, so the output only depends on the logits
+	bool is_greedy() const { return params.temperature <= 0.0f; }
+
+private:
+	const struct llama_model *model;
+	llama_sampler_params params;
+	int n_vocab;
+	std::vector<llama_token_data> candidates;
+	// ring buffer of the last repeat_last_n tokens
+	std::vector<llama_token> last_tokens;
+	size_t last_tokens_pos = 0;
+	std::vector<llama_token> penalty_scratch;
+	std::mt19937 rng;
+};
+
+#endif // LLAMA_SAMPLER_H
@@ -2,28 +2,30 @@
 #include "plugin-support.h"
 
 #include <obs-module.h>
+#include <mutex>
 #include <string>
 #include <nlohmann/json.hpp>
 
 llm_config_data global_llm_config;
 llm_global_context global_llm_context;
 
-void config_defaults()
+static std::mutex published_config_mutex;
+static std::shared_ptr<const llm_config_data> published_config;
+
+void llm_config_publish()
 {
-	const std::string LLAMA_DEFAULT_SYSTEM_PROMPT = R"([INST] <<SYS>>
-You are a helpful, respectful, positive, safe and honest assistant.
-Don't include harmful, unethical, racist, sexist, toxic, dangerous, socially biased, untruthful or illegal content.
-<</SYS>> Q: {0} [/INST] A:)";
-
-	global_llm_config.local = true;
-	global_llm_config.local_model_path = "";
-	global_llm_config.cloud_model_name = "";
-	global_llm_config.cloud_api_key = "";
-	global_llm_config.temperature = 0.9f;
-	global_llm_config.max_output_tokens = 64;
-	global_llm_config.system_prompt = LLAMA_DEFAULT_SYSTEM_PROMPT;
-    global_llm_config.end_sequence = "";
-	global_llm_config.workflows = {};
+	auto config = std::make_shared<const llm_config_data>(global_llm_config);
+	std::lock_guard<std::mutex> lock(published_config_mutex);
+	published_config = std::move(config);
+}
+
+std::shared_ptr<const llm_config_data> llm_config_snapshot()
+{
+	std::lock_guard<std::mutex> lock(published_config_mutex);
+	if (published_config == nullptr) {
+		published_config = std::make_shared<const llm_config_data>(global_llm_config);
+	}
+	return published_config;
 }
 
 void create_config_folder()
@@ -72,6 +74,7 @@ llm_config_data llm_config_data_from_json(const std::string &json);
 
 int saveConfig(bool create_if_not_exist)
 {
+	llm_config_publish();
 	config_t *config_file;
 	if (getConfig(&config_file, create_if_not_exist) == OBS_BRAIN_CONFIG_SUCCESS) {
 		std::string json = llm_config_data_to_json(global_llm_config);
@@ -90,6 +93,7 @@ int loadConfig()
 		const char *json = config_get_string(config_file, "general", "llm_config");
 		if (json != nullptr) {
 			global_llm_config = llm_config_data_from_json(json);
+			llm_config_publish();
 			config_close(config_file);
 			return OBS_BRAIN_CONFIG_SUCCESS;
 		}
@@ -116,10 +120,45 @@ std::string llm_config_data_to_json(const llm_config_data &data)
 	j["cloud_model_name"] = data.cloud_model_name;
 	j["cloud_api_key"] = data.cloud_api_key;
 	j["temperature"] = data.temperature;
+	j["top_k"] = data.top_k;
+	j["top_p"] = data.top_p;
+	j["repeat_penalty"] = data.repeat_penalty;
 	j["max_output_tokens"] = data.max_output_tokens;
 	j["system_prompt"] = data.system_prompt;
     j["end_sequence"] = data.end_sequence;
+	j["chat_turn_template"] = data.chat_turn_template;
+	j["stop_sequences"] = data.stop_sequences;
+	j["n_parallel"] = data.n_parallel;
+	j["prefix_cache"] = data.prefix_cache;
+	j["session_cache"] = data.session_cache;
+	j["context_shift"] = data.context_shift;
+	j["draft_model_path"] = data.draft_model_path;
+	j["n_draft"] = data.n_draft;
+	j["n_ctx"] = data.n_ctx;
+	j["kv_cache_type"] = data.kv_cache_type;
+	j["use_mmap"] = data.use_mmap;
+	j["use_mlock"] = data.use_mlock;
+	j["memory_budget_mb"] = data.memory_budget_mb;
+	j["inference_governor"] = data.inference_governor;
+	j["n_batch"] = data.n_batch;
+	j["n_threads"] = data.n_threads;
+	j["n_threads_batch"] = data.n_threads_batch;
+	j["cpu_affinity"] = data.cpu_affinity;
+	j["low_priority"] = data.low_priority;
+	j["auto_tune_threads"] = data.auto_tune_threads;
+	j["background_context"] = data.background_context;
+	j["background_n_ctx"] = data.background_n_ctx;
+	j["background_n_threads"] = data.background_n_threads;
+	j["idle_unload_minutes"] = data.idle_unload_minutes;
+	j["idle_unload_model"] = data.idle_unload_model;
+	j["metrics_log"] = data.metrics_log;
 	j["workflows"] = data.workflows;
+	j["workflow_max_concurrency"] = data.workflow_max_concurrency;
+	j["workflow_input_max_bytes"] = data.workflow_input_max_bytes;
+	j["workflow_file_sync"] = data.workflow_file_sync;
+	j["response_cache"] = data.response_cache;
+	j["response_cache_mb"] = data.response_cache_mb;
+	j["response_cache_disk"] = data.response_cache_disk;
 	return j.dump();
 }
 
@@ -133,9 +172,44 @@ llm_config_data llm_config_data_from_json(const std::string &json)
 	data.cloud_model_name = j["cloud_model_name"];
 	data.cloud_api_key = j["cloud_api_key"];
 	data.temperature = j["temperature"];
+	data.top_k = j.value("top_k", 40);
+	data.top_p = j.value("top_p", 0.95f);
+	data.repeat_penalty = j.value("repeat_penalty", 1.1f);
 	data.max_output_tokens = j["max_output_tokens"];
 	data.system_prompt = j["system_prompt"];
     data.end_sequence = j.value("end_sequence", "");
+	data.chat_turn_template = j.value("chat_turn_template", "");
+	data.stop_sequences = j.value("stop_sequences", std::vector<std::string>());
+	data.n_parallel = j.value("n_parallel", 4);
+	data.prefix_cache = j.value("prefix_cache", true);
+	data.session_cache = j.value("session_cache", false);
+	data.context_shift = j.value("context_shift", false);
+	data.draft_model_path = j.value("draft_model_path", "");
+	data.n_draft = j.value("n_draft", 5);
+	data.n_ctx = j.value("n_ctx", 512);
+	data.kv_cache_type = j.value("kv_cache_type", 0);
+	data.use_mmap = j.value("use_mmap", true);
+	data.use_mlock = j.value("use_mlock", false);
+	data.memory_budget_mb = j.value("memory_budget_mb", 0);
+	data.inference_governor = j.value("inference_governor", true);
+	data.n_batch = j.value("n_batch", 512);
+	data.n_threads = j.value("n_threads", 0);
+	data.n_threads_batch = j.value("n_threads_batch", 0);
+	data.cpu_affinity = j.value("cpu_affinity", "");
+	data.low_priority = j.value("low_priority", false);
+	data.auto_tune_threads = j.value("auto_tune_threads", false);
+	data.background_context = j.value("background_context", false);
+	data.background_n_ctx = j.value("background_n_ctx", 1024);
+	data.background_n_threads = j.value("background_n_threads", 0);
+	data.idle_unload_minutes = j.value("idle_unload_minutes", 0);
+	data.idle_unload_model = j.value("idle_unload_model", false);
+	data.metrics_log = j.value("metrics_log", false);
 	data.workflows = j["workflows"];
+	data.workflow_max_concurrency = j.value("workflow_max_concurrency", 2);
+	data.workflow_input_max_bytes = j.value("workflow_input_max_bytes", 8192);
+	data.workflow_file_sync = j.value("workflow_file_sync", 0);
+	data.response_cache = j.value("response_cache", false);
+	data.response_cache_mb = j.value("response_cache_mb", 16);
+	data.response_cache_disk = j.value("response_cache_disk", false);
 	return data;
 }
@@ -3,6 +3,7 @@
 
 #include <util/config-file.h>
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -22,6 +23,15 @@ struct llm_config_data {
 	// temperature
 	float temperature;
 
+	// top-k sampling, 0 disables
+	int top_k;
+
+	// top-p (nucleus) sampling, 1 disables
+	float top_p;
+
+	// repetition penalty, 1 disables
+	float repeat_penalty;
+
 	// max output tokens
 	uint16_t max_output_tokens;
 
@@ -31,18 +41,139 @@ struct llm_config_data {
     // end sequence
     std::string end_sequence;
 
+	// template of the follow-up turns of a chat session, {0} is replaced with the prompt. the
+	// part of the system prompt after {0} when empty.
+	std::string chat_turn_template;
+
+	// additional literal stop strings
+	std::vector<std::string> stop_sequences;
+
+	// number of requests decoded together on the local model
+	int n_parallel;
+
+	// max. tokens of one request (prompt and generation) on the local model
+	int n_ctx;
+
+	// element type of the K cache: 0 f16, 1 q8_0, 2 q4_0. quantized keys take a half or a
+	// quarter of the memory, but cannot be shifted, so context_shift is off with them.
+	int kv_cache_type;
+
+	// map the model file instead of reading it into memory
+	bool use_mmap;
+
+	// lock the weights in RAM so they are never paged out
+	bool use_mlock;
+
+	// max. MB of the model and its contexts, contexts are made smaller to fit and a model that
+	// does not fit is not loaded. 0 for no limit.
+	int memory_budget_mb;
+
+	// hold back inference while OBS lags rendering or skips encoder frames: workflows are
+	// deferred first, then decoding is slowed down
+	bool inference_governor;
+
+	// max. tokens per llama_decode call on the local model
+	int n_batch;
+
+	// threads used by the local model for generation, 0 uses the tuned or llama.cpp default
+	int n_threads;
+
+	// threads used by the local model for prompt processing, 0 uses n_threads
+	int n_threads_batch;
+
+	// cores the inference threads are pinned to, e.g. "0-3,6", empty for all cores
+	std::string cpu_affinity;
+
+	// run inference below normal priority so the encoder and render threads go first
+	bool low_priority;
+
+	// measure generation speed at several thread counts after loading and pick the smallest
+	// count that gets close to the best speed
+	bool auto_tune_threads;
+
+	// keep the KV cache of the system prompt prefix (text before {0}) between requests
+	bool prefix_cache;
+
+	// when a generation fills its sequence, drop the older half of it after the prompt
+	// template prefix and continue instead of ending the generation
+	bool context_shift;
+
+	// small model with the same vocabulary that proposes tokens for the local model to verify
+	// (speculative decoding), empty to disable
+	std::string draft_model_path;
+
+	// tokens the draft model proposes per step
+	int n_draft;
+
+	// save the KV cache of the prompt prefix to the sessions folder and restore it after a
+	// restart instead of decoding the prefix again
+	bool session_cache;
+
+	// run workflow requests on a second context of the local model, so they never wait for
+	// the dock or make it wait. it shares the weights and only costs its KV cache.
+	bool background_context;
+
+	// max. tokens of one workflow request on the background context
+	int background_n_ctx;
+
+	// threads of the background context, 0 uses those of the dock context
+	int background_n_threads;
+
+	// free the local context after this many idle minutes, 0 disables
+	int idle_unload_minutes;
+
+	// also free the model weights when idle, not only the context
+	bool idle_unload_model;
+
+	// append the metrics of every request to metrics.jsonl in the module config folder
+	bool metrics_log;
+
 	// workflows
 	std::vector<std::string> workflows;
+
+	// max. workflows generating at the same time
+	int workflow_max_concurrency;
+
+	// max. bytes of a file that a workflow reads as input
+	int workflow_input_max_bytes;
+
+	// when workflow output files are synced to the disk, a file_sink_sync value
+	int workflow_file_sync;
+
+	// answer workflow requests that were generated before from the response cache
+	bool response_cache;
+
+	// memory (and disk) budget of the response cache in MB
+	int response_cache_mb;
+
+	// also keep the response cache in the module config folder
+	bool response_cache_disk;
 };
 
 // forward declaration
 struct llama_context;
+struct llama_model;
+class inference_scheduler;
 
 struct llm_global_context {
 	// error message
 	std::string error_message;
+	// llama model, kept when only the context is unloaded while idle
+	struct llama_model *model_llama = nullptr;
 	// llama context
 	struct llama_context *ctx_llama;
+	// draft model and its single sequence context for speculative decoding, nullptr if
+	// none is configured
+	struct llama_model *draft_model_llama = nullptr;
+	struct llama_context *draft_ctx_llama = nullptr;
+	// generation threads picked by auto-tuning, 0 if not tuned
+	int n_threads_tuned = 0;
+	// runs all inference requests on ctx_llama
+	inference_scheduler *scheduler = nullptr;
+	// context of the workflow requests when background_context is set, nullptr otherwise
+	struct llama_context *background_ctx_llama = nullptr;
+	// runs the workflow requests on background_ctx_llama
+	inference_scheduler *background_scheduler = nullptr;
 };
 
 extern llm_config_data global_llm_config;
@@ -54,4 +185,12 @@ extern llm_global_context global_llm_context;
 int saveConfig(bool create_if_not_exist = false);
 int loadConfig();
 
+// reset global_llm_config to the settings of a new install
+void config_defaults();
+
+// the UI thread changes global_llm_config in place, other threads read the copy published last
+// instead. loadConfig() and saveConfig() publish it.
+void llm_config_publish();
+std::shared_ptr<const llm_config_data> llm_config_snapshot();
+
 #endif // LLM_CONFIG_DATA_H
@@ -0,0 +1,56 @@
+#include "llm-config-data.h"
+
+#include <string>
+
+void config_defaults()
+{
+	const std::string LLAMA_DEFAULT_SYSTEM_PROMPT = R"([INST] <<SYS>>
+You are a helpful, respectful, positive, safe and honest assistant.
+Don't include harmful, unethical, racist, sexist, toxic, dangerous, socially biased, untruthful or illegal content.
+<</SYS>> Q: {0} [/INST] A:)";
+
+	global_llm_config.local = true;
+	global_llm_config.local_model_path = "";
+	global_llm_config.cloud_model_name = "";
+	global_llm_config.cloud_api_key = "";
+	global_llm_config.temperature = 0.9f;
+	global_llm_config.top_k = 40;
+	global_llm_config.top_p = 0.95f;
+	global_llm_config.repeat_penalty = 1.1f;
+	global_llm_config.max_output_tokens = 64;
+	global_llm_config.system_prompt = LLAMA_DEFAULT_SYSTEM_PROMPT;
+	global_llm_config.end_sequence = "";
+	global_llm_config.chat_turn_template = "";
+	global_llm_config.stop_sequences = {};
+	global_llm_config.n_parallel = 4;
+	global_llm_config.prefix_cache = true;
+	global_llm_config.session_cache = false;
+	global_llm_config.context_shift = false;
+	global_llm_config.draft_model_path = "";
+	global_llm_config.n_draft = 5;
+	global_llm_config.n_ctx = 512;
+	global_llm_config.kv_cache_type = 0;
+	global_llm_config.use_mmap = true;
+	global_llm_config.use_mlock = false;
+	global_llm_config.memory_budget_mb = 0;
+	global_llm_config.inference_governor = true;
+	global_llm_config.n_batch = 512;
+	global_llm_config.n_threads = 0;
+	global_llm_config.n_threads_batch = 0;
+	global_llm_config.cpu_affinity = "";
+	global_llm_config.low_priority = false;
+	global_llm_config.auto_tune_threads = false;
+	global_llm_config.background_context = false;
+	global_llm_config.background_n_ctx = 1024;
+	global_llm_config.background_n_threads = 0;
+	global_llm_config.idle_unload_minutes = 0;
+	global_llm_config.idle_unload_model = false;
+	global_llm_config.metrics_log = false;
+	global_llm_config.workflows = {};
+	global_llm_config.workflow_max_concurrency = 2;
+	global_llm_config.workflow_input_max_bytes = 8192;
+	global_llm_config.workflow_file_sync = 0;
+	global_llm_config.response_cache = false;
+	global_llm_config.response_cache_mb = 16;
+	global_llm_config.response_cache_disk = false;
+}
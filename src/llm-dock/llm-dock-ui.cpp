@@ -2,19 +2,25 @@
 
 #include <obs-frontend-api.h>
 
-#include <regex>
-
 #include "plugin-support.h"
 #include "llm-dock-ui.hpp"
 #include "llm-dock.h"
 #include "llama-inference.h"
+#include "model-loader.h"
+#include "inference-metrics.h"
 #include "LLMSettingsDialog.hpp"
 #include "llm-config-data.h"
 #include "ui/ui_dockwidget.h"
 #include "Workflows.hpp"
+#include "workflow-engine.h"
 
 QDockWidget *createLLMDockWidget(QMainWindow *parent);
 
+// how often streamed text is appended to the dock
+static const int UI_FLUSH_INTERVAL_MS = 50;
+// old paragraphs are trimmed from the generated text beyond this
+static const int MAX_GENERATED_BLOCKS = 500;
+
 void register_llm_dock(void)
 {
 	// load plugin settings from config
@@ -27,31 +33,31 @@ void register_llm_dock(void)
 	if (global_llm_config.local) {
 		obs_log(LOG_INFO, "Using local LLM model: %s",
 			global_llm_config.local_model_path.c_str());
-		// initialize the local LLM model
 		if (global_llm_config.local_model_path.empty()) {
 			obs_log(LOG_ERROR, "LLM Model not found.");
 		} else {
-			global_llm_context.ctx_llama =
-				llama_init_context(global_llm_config.local_model_path);
-
-			// If the model is loaded successfully, register the GPT dock
-			if (global_llm_context.ctx_llama == nullptr) {
-				obs_log(LOG_ERROR, "Failed to load LLM model from %s.",
-					global_llm_config.local_model_path.c_str());
-				global_llm_context.error_message =
-					"Failed to load local LLM model.";
-				return;
-			}
+			// the model loads in the background, requests stay queued until it is ready
+			llm_model_load_async(global_llm_config.local_model_path);
 		}
 	} else {
 		obs_log(LOG_INFO, "Using cloud LLM model: %s",
 			global_llm_config.cloud_model_name.c_str());
 	}
 
-	// register the GPT dock
+	// workflows queue their requests like the dock, also while the model is loading
+	workflow_engine_start();
+
+	// register the GPT dock right away
 	obs_frontend_add_dock(createLLMDockWidget((QMainWindow *)obs_frontend_get_main_window()));
 }
 
+void unregister_llm_dock(void)
+{
+	// stop the workflows and inference and free the model before the module goes away
+	workflow_engine_stop();
+	llm_model_shutdown();
+}
+
 QDockWidget *createLLMDockWidget(QMainWindow *parent)
 {
 	QDockWidget *dock = new LLMDockWidgetUI(parent);
@@ -76,8 +82,31 @@ LLMDockWidgetUI::LLMDockWidgetUI(QWidget *parent) : QDockWidget(parent), ui(new
 	this->connect(this->ui->generate, &QPushButton::clicked, this, &LLMDockWidgetUI::generate);
 	this->connect(this->ui->clear, &QPushButton::clicked, this, &LLMDockWidgetUI::clear);
 	this->connect(this->ui->stop, &QPushButton::clicked, this, &LLMDockWidgetUI::stop);
-	this->connect(this, &LLMDockWidgetUI::update_text_signal, this,
-		      &LLMDockWidgetUI::update_text);
+	this->current_session = this->ui->session->currentText();
+	this->connect(this->ui->session, QOverload<int>::of(&QComboBox::activated), this,
+		      &LLMDockWidgetUI::switch_session);
+	this->ui->generated->document()->setMaximumBlockCount(MAX_GENERATED_BLOCKS);
+	this->flush_timer.setInterval(UI_FLUSH_INTERVAL_MS);
+	this->connect(&this->flush_timer, &QTimer::timeout, this, &LLMDockWidgetUI::flush_pending);
+	this->connect(this, &LLMDockWidgetUI::update_status_signal, this,
+		      &LLMDockWidgetUI::update_status);
+	// show the model loading state
+	llm_model_set_status_callback([this](const llm_model_status &status) {
+		emit update_status_signal(QString::fromStdString(llm_model_status_text(status)));
+	});
+	this->update_status(QString::fromStdString(llm_model_status_text(llm_model_get_status())));
+	// show the latency of the last dock request and the recent aggregates, workflow requests
+	// would replace the line of the request the user just sent
+	this->connect(this, &LLMDockWidgetUI::update_metrics_signal, this,
+		      &LLMDockWidgetUI::update_metrics);
+	inference_metrics_set_listener([this](const inference_metrics &metrics,
+					      const inference_metrics_summary &summary) {
+		if (metrics.priority != INFERENCE_PRIORITY_INTERACTIVE) {
+			return;
+		}
+		emit update_metrics_signal(
+			QString::fromStdString(inference_metrics_status_text(metrics, summary)));
+	});
 	// connect workflows
 	this->connect(this->ui->workflows, &QPushButton::clicked, this, [=]() {
 		Workflows *workflows_dialog = new Workflows(this);
@@ -85,7 +114,15 @@ LLMDockWidgetUI::LLMDockWidgetUI(QWidget *parent) : QDockWidget(parent), ui(new
 	});
 }
 
-LLMDockWidgetUI::~LLMDockWidgetUI() {}
+LLMDockWidgetUI::~LLMDockWidgetUI()
+{
+	llm_model_set_status_callback(nullptr);
+	inference_metrics_set_listener(nullptr);
+	// running requests end, their callbacks only touch the shared buffers
+	if (this->cancel_token) {
+		*this->cancel_token = true;
+	}
+}
 
 void LLMDockWidgetUI::generate()
 {
@@ -93,7 +130,18 @@ void LLMDockWidgetUI::generate()
 	if (input_text.isEmpty()) {
 		return;
 	}
-    this->stop_flag = false;
+	if (global_llm_context.scheduler == nullptr) {
+		this->update_status(QString("No local LLM model loaded"));
+		return;
+	}
+	const llm_model_status model_status = llm_model_get_status();
+	if (model_status.state == LLM_MODEL_FAILED) {
+		this->update_status(QString::fromStdString(llm_model_status_text(model_status)));
+		return;
+	}
+	if (model_status.state != LLM_MODEL_READY) {
+		this->update_status(QString("Waiting for the model to load..."));
+	}
 
 	this->ui->generated->insertHtml(
 		QString("<p style=\"color:#ffffff;\">%1</p><br/>").arg(input_text));
@@ -102,41 +150,115 @@ void LLMDockWidgetUI::generate()
 	// also clear any styles
 	this->ui->prompt->setStyleSheet("QTextEdit { background-color: #000000; color: #ffffff; }");
 
-	// call LLM inference on a separate thread using a lambda function
-	std::thread t([input_text, this]() {
-		std::string generated_text = llama_inference(
-			input_text.toStdString(), global_llm_context.ctx_llama,
-			[this](const std::string &partial_generation) {
-				emit update_text_signal(QString::fromStdString(partial_generation),
-							true);
-			},
-            [this](const std::string &generation) {
-                // check if the stop button was pressed or the generation ends with the end sequence
-                if (this->stop_flag) {
-                    return true;
-                }
-                if (!global_llm_config.end_sequence.empty()) {
-                    std::regex end_sequence_regex(global_llm_config.end_sequence);
-                    if (std::regex_search(generation, end_sequence_regex)) {
-                        return true;
-                    }
-                }
-                return false;
-            });
-		emit update_text_signal(QString("<br/>"), true);
-	});
-	t.detach();
+	// queue the request on the inference thread, the stop button cancels all dock requests
+	if (!this->cancel_token || *this->cancel_token) {
+		this->cancel_token = make_cancellation_token();
+	}
+
+	inference_job job;
+	job.prompt = input_text.toStdString();
+	job.priority = INFERENCE_PRIORITY_INTERACTIVE;
+	job.session = this->current_session.toStdString();
+	job.cancel = this->cancel_token;
+	std::shared_ptr<pending_output> pending = this->pending;
+	job.partial_generation_callback = [pending](const std::string &partial_generation) {
+		std::lock_guard<std::mutex> lock(pending->mutex);
+		pending->text += QString::fromStdString(partial_generation);
+	};
+	job.prefill_progress_callback = [pending](int n_done, int n_total,
+						  float tokens_per_second) {
+		std::lock_guard<std::mutex> lock(pending->mutex);
+		pending->status = QString("Reading prompt: %1 / %2 tokens (%3 t/s)")
+					  .arg(n_done)
+					  .arg(n_total)
+					  .arg(tokens_per_second, 0, 'f', 1);
+		pending->has_status = true;
+	};
+	job.done_callback = [pending](const std::string &, inference_stop_reason) {
+		std::lock_guard<std::mutex> lock(pending->mutex);
+		pending->text += "\n";
+		pending->status.clear();
+		pending->has_status = true;
+		pending->active_requests--;
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(pending->mutex);
+		pending->active_requests++;
+	}
+	this->flush_timer.start();
+	global_llm_context.scheduler->submit(std::move(job));
+}
+
+void LLMDockWidgetUI::flush_pending()
+{
+	QString text;
+	QString status;
+	bool has_status = false;
+	bool done = false;
+	{
+		std::lock_guard<std::mutex> lock(this->pending->mutex);
+		text.swap(this->pending->text);
+		status.swap(this->pending->status);
+		has_status = this->pending->has_status;
+		this->pending->has_status = false;
+		done = this->pending->active_requests == 0;
+	}
+	if (!text.isEmpty()) {
+		this->update_text(text, true);
+	}
+	if (has_status) {
+		this->update_status(status);
+	}
+	// the last flush after all requests are done empties the buffers
+	if (done) {
+		this->flush_timer.stop();
+	}
 }
 
 void LLMDockWidgetUI::clear()
 {
 	this->ui->prompt->clear();
 	this->ui->generated->clear();
+	// the next request starts a new conversation
+	if (global_llm_context.scheduler != nullptr) {
+		global_llm_context.scheduler->reset_session(this->current_session.toStdString());
+	}
+}
+
+void LLMDockWidgetUI::switch_session(int index)
+{
+	const QString name = this->ui->session->itemText(index);
+	if (name == this->current_session) {
+		return;
+	}
+	// the streamed text of a running request belongs to the shown session
+	bool busy = false;
+	{
+		std::lock_guard<std::mutex> lock(this->pending->mutex);
+		busy = this->pending->active_requests > 0;
+	}
+	if (busy) {
+		this->ui->session->setCurrentIndex(
+			this->ui->session->findText(this->current_session));
+		this->update_status(QString("Switch the session when the request is done"));
+		return;
+	}
+	this->session_text[this->current_session] = this->ui->generated->toHtml();
+	this->current_session = name;
+	this->ui->generated->clear();
+	const QString text = this->session_text.take(name);
+	if (!text.isEmpty()) {
+		this->ui->generated->setHtml(text);
+		this->ui->generated->moveCursor(QTextCursor::End);
+	}
 }
 
 void LLMDockWidgetUI::stop()
 {
-    this->stop_flag = true;
+	if (this->cancel_token) {
+		*this->cancel_token = true;
+	}
 }
 
 void LLMDockWidgetUI::update_text(const QString &text, bool partial_generation)
@@ -145,18 +267,13 @@ void LLMDockWidgetUI::update_text(const QString &text, bool partial_generation)
 		if (text.isEmpty()) {
 			return;
 		}
-		// if text is just a new line, append a <br> tag
-		if (text == "\n") {
-			this->ui->generated->insertHtml("<br>");
-			return;
-		}
-		// replace spaces with non-breaking spaces
-		QString text_with_non_breaking_spaces = text;
-		text_with_non_breaking_spaces.replace(" ", "&nbsp;");
-
-		// append text in a different color
-		this->ui->generated->insertHtml(QString("<span style=\"color:#00ff00;\">%1</span>")
-							.arg(text_with_non_breaking_spaces));
+		// append as plain text in a different color: no HTML parsing, spaces are kept and
+		// line breaks start new blocks, which the document trims beyond its block limit
+		QTextCursor cursor(this->ui->generated->document());
+		cursor.movePosition(QTextCursor::End);
+		QTextCharFormat format;
+		format.setForeground(QColor("#00ff00"));
+		cursor.insertText(text, format);
 	} else {
 		this->ui->generated->insertHtml(
 			QString("<p style=\"color:#ffffff;\">%1</p>").arg(text));
@@ -164,3 +281,19 @@ void LLMDockWidgetUI::update_text(const QString &text, bool partial_generation)
 	// always scroll to the bottom
 	this->ui->generated->moveCursor(QTextCursor::End);
 }
+
+void LLMDockWidgetUI::update_status(const QString &status)
+{
+	// the model state, e.g. its memory, shows while nothing else is going on
+	if (status.isEmpty()) {
+		this->ui->status->setText(
+			QString::fromStdString(llm_model_status_text(llm_model_get_status())));
+	} else {
+		this->ui->status->setText(status);
+	}
+}
+
+void LLMDockWidgetUI::update_metrics(const QString &metrics)
+{
+	this->ui->metrics->setText(metrics);
+}
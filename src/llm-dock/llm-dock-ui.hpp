@@ -2,6 +2,13 @@
 #define LLMDOCKWIDGETUI_HPP
 
 #include <QDockWidget>
+#include <QMap>
+#include <QTimer>
+
+#include <memory>
+#include <mutex>
+
+#include "inference-scheduler.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -20,13 +27,37 @@ public slots:
 	void clear();
     void stop();
 	void update_text(const QString &text, bool partial_generation);
+	void update_status(const QString &status);
+	void update_metrics(const QString &metrics);
+	void flush_pending();
+	void switch_session(int index);
 
 signals:
-	void update_text_signal(const QString &text, bool partial_generation);
+	void update_status_signal(const QString &status);
+	void update_metrics_signal(const QString &metrics);
 
 private:
 	Ui::BrainDock *ui;
-    bool stop_flag = false;
+	// cancels the current request when the stop button is pressed
+	cancellation_token cancel_token;
+
+	// generated text and prefill progress are buffered by the inference thread and appended
+	// by flush_timer on the UI thread, at most once per interval however fast tokens arrive.
+	// the requests share the buffers, so they outlive the dock while requests finish.
+	struct pending_output {
+		std::mutex mutex;
+		QString text;
+		QString status;
+		bool has_status = false;
+		int active_requests = 0;
+	};
+	QTimer flush_timer;
+	std::shared_ptr<pending_output> pending = std::make_shared<pending_output>();
+
+	// the chat session of the dock requests, the text of the others is kept while they are
+	// not shown
+	QString current_session;
+	QMap<QString, QString> session_text;
 };
 
 #endif // LLMDOCKWIDGETUI_HPP
@@ -5,6 +5,7 @@ extern "C" {
 #endif
 
 void register_llm_dock(void);
+void unregister_llm_dock(void);
 
 #ifdef __cplusplus
 }
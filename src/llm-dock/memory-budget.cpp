@@ -0,0 +1,124 @@
+#include "memory-budget.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+static const double MB = 1024.0 * 1024.0;
+
+llm_memory_estimate &llm_memory_estimate::operator+=(const llm_memory_estimate &other)
+{
+	model_bytes += other.model_bytes;
+	state_bytes += other.state_bytes;
+	compute_bytes += other.compute_bytes;
+	return *this;
+}
+
+// an unsigned integer key, the GGUF writers use 32 bits for these
+static bool read_u32(const struct gguf_context *gguf, const std::string &key, uint32_t &value)
+{
+	const int key_id = gguf_find_key(gguf, key.c_str());
+	if (key_id < 0 || gguf_get_kv_type(gguf, key_id) != GGUF_TYPE_UINT32) {
+		return false;
+	}
+	value = gguf_get_val_u32(gguf, key_id);
+	return true;
+}
+
+bool llm_model_shape_from_file(const std::string &model_file_path, llm_model_shape &shape)
+{
+	std::error_code ec;
+	shape.file_size =
+		(uint64_t)std::filesystem::file_size(std::filesystem::u8path(model_file_path), ec);
+	if (ec) {
+		return false;
+	}
+
+	// only the header and the tensor infos are read
+	struct gguf_init_params params = {true, nullptr};
+	struct gguf_context *gguf = gguf_init_from_file(model_file_path.c_str(), params);
+	if (gguf == nullptr) {
+		return false;
+	}
+	bool ok = false;
+	const int arch_id = gguf_find_key(gguf, "general.architecture");
+	if (arch_id >= 0 && gguf_get_kv_type(gguf, arch_id) == GGUF_TYPE_STRING) {
+		const std::string arch = gguf_get_val_str(gguf, arch_id);
+		ok = read_u32(gguf, arch + ".block_count", shape.n_layer) &&
+		     read_u32(gguf, arch + ".embedding_length", shape.n_embd) &&
+		     read_u32(gguf, arch + ".attention.head_count", shape.n_head) &&
+		     shape.n_head > 0;
+		// without grouped-query attention every head has its own keys and values
+		if (!read_u32(gguf, arch + ".attention.head_count_kv", shape.n_head_kv)) {
+			shape.n_head_kv = shape.n_head;
+		}
+		if (!read_u32(gguf, arch + ".feed_forward_length", shape.n_ff)) {
+			shape.n_ff = 4 * shape.n_embd;
+		}
+	}
+	const int tokens_id = gguf_find_key(gguf, "tokenizer.ggml.tokens");
+	if (tokens_id >= 0 && gguf_get_kv_type(gguf, tokens_id) == GGUF_TYPE_ARRAY) {
+		shape.n_vocab = (uint32_t)gguf_get_arr_n(gguf, tokens_id);
+	}
+	gguf_free(gguf);
+	return ok;
+}
+
+enum ggml_type llm_kv_cache_type(int kv_cache_type)
+{
+	switch (kv_cache_type) {
+	case 1:
+		return GGML_TYPE_Q8_0;
+	case 2:
+		return GGML_TYPE_Q4_0;
+	default:
+		return GGML_TYPE_F16;
+	}
+}
+
+// bytes of n elements of a KV cache type, q8_0 and q4_0 store blocks of 32 with an f16 scale
+static uint64_t type_bytes(enum ggml_type type, uint64_t n)
+{
+	switch (type) {
+	case GGML_TYPE_Q8_0:
+		return n / 32 * 34;
+	case GGML_TYPE_Q4_0:
+		return n / 32 * 18;
+	case GGML_TYPE_F32:
+		return n * 4;
+	default:
+		return n * 2;
+	}
+}
+
+llm_memory_estimate llm_estimate_context(const llm_model_shape &shape, int n_ctx, int n_batch,
+					 enum ggml_type type_k)
+{
+	llm_memory_estimate memory;
+	const uint64_t n_embd_kv = (uint64_t)shape.n_embd / shape.n_head * shape.n_head_kv;
+	const uint64_t n_cells = (uint64_t)std::max(n_ctx, 0) * shape.n_layer * n_embd_kv;
+	const uint64_t n_tokens = (uint64_t)std::min(std::max(n_batch, 1), std::max(n_ctx, 1));
+	// the V cache is always f16
+	memory.state_bytes = type_bytes(type_k, n_cells) + type_bytes(GGML_TYPE_F16, n_cells) +
+			     (uint64_t)shape.n_vocab * n_tokens * sizeof(float);
+	// the attention scores of a full batch against the whole context dominate, next to the
+	// feed-forward and output activations
+	memory.compute_bytes = n_tokens * sizeof(float) *
+			       ((uint64_t)n_ctx * shape.n_head + 2 * (uint64_t)shape.n_ff +
+				4 * (uint64_t)shape.n_embd + shape.n_vocab);
+	return memory;
+}
+
+std::string llm_memory_text(const llm_memory_estimate &memory, uint64_t budget_bytes)
+{
+	char text[160];
+	snprintf(text, sizeof(text), "model %.0f MB + KV %.0f MB + compute ~%.0f MB = %.0f MB",
+		 memory.model_bytes / MB, memory.state_bytes / MB, memory.compute_bytes / MB,
+		 memory.total() / MB);
+	std::string result = text;
+	if (budget_bytes > 0) {
+		snprintf(text, sizeof(text), " of %.0f MB", budget_bytes / MB);
+		result += text;
+	}
+	return result;
+}
@@ -0,0 +1,51 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <cstdint>
+#include <string>
+
+#include <llama.h>
+
+// Memory the local model takes inside the OBS process: its weights, the state of every context
+// (KV cache and output buffers) and their compute buffers. It is estimated from the GGUF header
+// before anything is loaded, so a configuration over memory_budget_mb can be downsized or
+// refused, and measured on the loaded contexts where llama.cpp reports it.
+
+// hyperparameters read from the GGUF header
+struct llm_model_shape {
+	uint64_t file_size = 0;
+	uint32_t n_layer = 0;
+	uint32_t n_embd = 0;
+	uint32_t n_head = 0;
+	uint32_t n_head_kv = 0;
+	uint32_t n_ff = 0;
+	uint32_t n_vocab = 0;
+};
+
+struct llm_memory_estimate {
+	// weights, mapped or read from the model file
+	uint64_t model_bytes = 0;
+	// KV cache and logits, what llama_get_state_size() reports
+	uint64_t state_bytes = 0;
+	// scratch buffers of the largest decode, llama.cpp does not report them
+	uint64_t compute_bytes = 0;
+
+	uint64_t total() const { return model_bytes + state_bytes + compute_bytes; }
+	llm_memory_estimate &operator+=(const llm_memory_estimate &other);
+};
+
+// read the shape from the header without loading the weights. false if the file is not a
+// GGUF model with the usual keys.
+bool llm_model_shape_from_file(const std::string &model_file_path, llm_model_shape &shape);
+
+// element type of the K cache for the kv_cache_type setting: 0 f16, 1 q8_0, 2 q4_0
+enum ggml_type llm_kv_cache_type(int kv_cache_type);
+
+// state and compute buffers of a context with n_ctx cells
+llm_memory_estimate llm_estimate_context(const llm_model_shape &shape, int n_ctx, int n_batch,
+					 enum ggml_type type_k);
+
+// e.g. "model 3891 MB + KV 1056 MB + compute ~310 MB = 5257 MB of 8192 MB"
+std::string llm_memory_text(const llm_memory_estimate &memory, uint64_t budget_bytes);
+
+#endif // MEMORY_BUDGET_H
@@ -0,0 +1,676 @@
+#include "model-loader.h"
+#include "llama-inference.h"
+#include "inference-scheduler.h"
+#include "inference-metrics.h"
+#include "inference-governor.h"
+#include "session-state.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+#include "thread-policy.h"
+
+#include <obs-module.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+static std::mutex status_mutex;
+static llm_model_status model_status;
+static std::function<void(const llm_model_status &)> status_callback;
+// the path to load and whether it changed while a load was running (guarded by status_mutex)
+static std::string model_path;
+static bool reload_requested = false;
+
+// serializes starting, joining and idle unloading around the loader thread. the loader thread
+// itself never takes it, so it can be joined with the lock held.
+static std::mutex loader_mutex;
+static std::thread loader_thread;
+// path and load options of global_llm_context.model_llama, only touched by the loader thread
+static std::string loaded_model_key;
+// path and load options of global_llm_context.draft_model_llama, only touched by the loader
+// thread
+static std::string loaded_draft_key;
+// model path and core set the thread count was tuned for, only touched by the loader thread
+static std::string tuned_for;
+
+// the workflow context could not be created with the current settings, workflows go to the
+// dock context until the next load
+static std::atomic<bool> background_failed{false};
+
+static std::mutex idle_mutex;
+static std::condition_variable idle_cv;
+static std::thread idle_thread;
+static bool idle_thread_stopping = false;
+
+static void notify_status(const llm_model_status &status,
+			  const std::function<void(const llm_model_status &)> &callback)
+{
+	if (callback) {
+		callback(status);
+	}
+}
+
+static void set_status(llm_model_state state, float progress)
+{
+	llm_model_status status;
+	std::function<void(const llm_model_status &)> callback;
+	{
+		std::lock_guard<std::mutex> lock(status_mutex);
+		// only report whole percent steps of the load progress
+		if (state == model_status.state &&
+		    (int)(progress * 100) == (int)(model_status.progress * 100)) {
+			return;
+		}
+		model_status.state = state;
+		model_status.progress = progress;
+		status = model_status;
+		callback = status_callback;
+	}
+	notify_status(status, callback);
+}
+
+static void load_progress_callback(float progress, void *)
+{
+	set_status(LLM_MODEL_LOADING, progress);
+}
+
+// reported with the next state change
+static void set_memory(const llm_memory_estimate &memory, uint64_t budget)
+{
+	std::lock_guard<std::mutex> lock(status_mutex);
+	model_status.memory = memory;
+	model_status.memory_budget = budget;
+}
+
+// a model is loaded again when its file or the options it was loaded with changed
+static std::string model_key(const std::string &model_file_path, const llm_config_data &config)
+{
+	return model_file_path + (config.use_mmap ? "|mmap" : "") +
+	       (config.use_mlock ? "|mlock" : "");
+}
+
+static uint64_t memory_budget(const llm_config_data &config)
+{
+	return (uint64_t)std::max(config.memory_budget_mb, 0) * 1024 * 1024;
+}
+
+// sizes of the contexts to create
+struct context_plan {
+	// tokens per sequence and sequences of the dock context
+	int n_ctx = 0;
+	int n_parallel = 0;
+	// the same for the workflow context, background_n_ctx is 0 without one
+	int background_n_ctx = 0;
+	int n_background = 0;
+	llm_memory_estimate memory;
+};
+
+// contexts are not shrunk below this many tokens per sequence to fit into the budget
+static const int MIN_BUDGET_N_CTX = 256;
+
+// estimate the memory of the models and contexts of config and shrink the contexts until they
+// fit into the memory budget: first the tokens per sequence, then the number of sequences.
+// false if even the smallest contexts do not fit.
+static bool plan_contexts(const std::string &model_file_path, const llm_config_data &config,
+			  context_plan &plan)
+{
+	plan.n_ctx = std::max(config.n_ctx, 64);
+	plan.n_parallel = std::max(config.n_parallel, 1);
+	plan.background_n_ctx = config.background_context ? std::max(config.background_n_ctx, 64)
+							  : 0;
+	plan.n_background = std::max(config.workflow_max_concurrency, 1);
+
+	llm_model_shape shape;
+	if (!llm_model_shape_from_file(model_file_path, shape)) {
+		// loading the model reports what is wrong with the file
+		obs_log(LOG_WARNING, "Cannot estimate the memory of %s", model_file_path.c_str());
+		return true;
+	}
+	llm_model_shape draft_shape;
+	const std::string &draft_path = config.draft_model_path;
+	const bool has_draft =
+		!draft_path.empty() && llm_model_shape_from_file(draft_path, draft_shape);
+	const enum ggml_type type_k = llm_kv_cache_type(config.kv_cache_type);
+	const int n_batch = std::max(config.n_batch, 1);
+	const auto estimate = [&]() {
+		llm_memory_estimate memory;
+		memory.model_bytes = shape.file_size;
+		memory += llm_estimate_context(shape, (plan.n_parallel + 1) * plan.n_ctx, n_batch,
+					       type_k);
+		if (plan.background_n_ctx > 0) {
+			memory += llm_estimate_context(shape,
+						       (plan.n_background + 1) *
+							       plan.background_n_ctx,
+						       n_batch, type_k);
+		}
+		if (has_draft) {
+			memory.model_bytes += draft_shape.file_size;
+			memory += llm_estimate_context(draft_shape, plan.n_ctx, n_batch, type_k);
+		}
+		return memory;
+	};
+
+	const uint64_t budget = memory_budget(config);
+	plan.memory = estimate();
+	bool downsized = false;
+	// halve a length down to MIN_BUDGET_N_CTX, a shorter one is kept
+	const auto shrink = [](int n_ctx) {
+		return std::max(n_ctx / 2, std::min(n_ctx, MIN_BUDGET_N_CTX));
+	};
+	while (budget > 0 && plan.memory.total() > budget) {
+		if (plan.n_ctx > MIN_BUDGET_N_CTX || plan.background_n_ctx > MIN_BUDGET_N_CTX) {
+			plan.n_ctx = shrink(plan.n_ctx);
+			plan.background_n_ctx = shrink(plan.background_n_ctx);
+		} else if (plan.n_parallel > 1) {
+			plan.n_parallel--;
+		} else if (plan.background_n_ctx > 0 && plan.n_background > 1) {
+			plan.n_background--;
+		} else {
+			obs_log(LOG_ERROR, "%s does not fit into the memory budget: %s",
+				model_file_path.c_str(),
+				llm_memory_text(plan.memory, budget).c_str());
+			return false;
+		}
+		plan.memory = estimate();
+		downsized = true;
+	}
+	if (downsized) {
+		obs_log(LOG_WARNING, "Contexts reduced to the memory budget: %d x %d tokens",
+			plan.n_parallel, plan.n_ctx);
+		if (plan.background_n_ctx > 0) {
+			obs_log(LOG_WARNING, "Workflow context reduced to %d x %d tokens",
+				plan.n_background, plan.background_n_ctx);
+		}
+	}
+	obs_log(LOG_INFO, "Estimated memory: %s", llm_memory_text(plan.memory, budget).c_str());
+	return true;
+}
+
+// load the model (unless it is loaded from that path already) and a context with the settings
+// of config, then swap them in once the requests running on the old context finished
+static llm_model_state load_model(const std::string &model_file_path,
+				  const llm_config_data &config)
+{
+	struct llama_model *old_model = global_llm_context.model_llama;
+	const bool serving = global_llm_context.ctx_llama != nullptr;
+
+	// nothing is loaded that would not fit
+	context_plan plan;
+	const bool fits = plan_contexts(model_file_path, config, plan);
+
+	struct llama_model *model = old_model;
+	if (fits && (model == nullptr || loaded_model_key != model_key(model_file_path, config))) {
+		model = llama_load_model(model_file_path, config, load_progress_callback, nullptr);
+		if (model != nullptr) {
+			session_state_set_model(model, model_file_path);
+		}
+	}
+
+	// tune once per model and core set, unless the thread count is configured
+	const std::string tune_key = model_file_path + "|" + config.cpu_affinity;
+	if (model != nullptr && fits && config.auto_tune_threads && config.n_threads <= 0 &&
+	    tuned_for != tune_key) {
+		set_status(LLM_MODEL_TUNING, 1.0f);
+		global_llm_context.n_threads_tuned =
+			llama_tune_threads(model, inference_core_count(config));
+		tuned_for = tune_key;
+	} else if (!config.auto_tune_threads) {
+		global_llm_context.n_threads_tuned = 0;
+		tuned_for.clear();
+	}
+
+	struct llama_context *ctx =
+		model != nullptr && fits
+			? llama_init_context(model, config, (plan.n_parallel + 1) * plan.n_ctx)
+			: nullptr;
+	if (ctx == nullptr) {
+		if (fits) {
+			obs_log(LOG_ERROR, "Failed to load LLM model from %s.",
+				model_file_path.c_str());
+			global_llm_context.error_message = "Failed to load local LLM model.";
+		} else {
+			global_llm_context.error_message =
+				"The local LLM model does not fit into the memory budget.";
+		}
+		if (model != nullptr && model != old_model) {
+			llama_free_model(model);
+		}
+		if (serving) {
+			// the old model keeps serving requests
+			return LLM_MODEL_READY;
+		}
+		set_memory(plan.memory, fits ? 0 : memory_budget(config));
+		if (old_model != nullptr) {
+			llama_free_model(old_model);
+			global_llm_context.model_llama = nullptr;
+		}
+		if (global_llm_context.scheduler != nullptr) {
+			global_llm_context.scheduler->cancel_queued();
+			global_llm_context.background_scheduler->cancel_queued();
+		}
+		return LLM_MODEL_FAILED;
+	}
+
+	// warm up before any request can touch the context
+	set_status(LLM_MODEL_WARMING, 1.0f);
+	llama_warmup_context(ctx);
+
+	// the draft model for speculative decoding only needs a context for one sequence
+	struct llama_model *old_draft_model = global_llm_context.draft_model_llama;
+	struct llama_model *draft_model = nullptr;
+	struct llama_context *draft_ctx = nullptr;
+	const std::string &draft_path = config.draft_model_path;
+	if (!draft_path.empty()) {
+		const bool draft_loaded = old_draft_model != nullptr &&
+					  loaded_draft_key == model_key(draft_path, config);
+		draft_model = draft_loaded ? old_draft_model : llama_load_model(draft_path, config);
+		if (draft_model != nullptr && llama_n_vocab(draft_model) == llama_n_vocab(model)) {
+			draft_ctx = llama_init_context(draft_model, config, plan.n_ctx);
+		}
+		if (draft_ctx != nullptr) {
+			llama_warmup_context(draft_ctx);
+			if (config.temperature > 0.0f) {
+				obs_log(LOG_WARNING,
+					"Draft model %s is only used with temperature 0, it is "
+					"loaded but unused at temperature %.2f",
+					draft_path.c_str(), config.temperature);
+			}
+		} else {
+			obs_log(LOG_WARNING,
+				"No draft model with the vocabulary of the model in %s, decoding "
+				"without speculation",
+				draft_path.c_str());
+			if (draft_model != nullptr && draft_model != old_draft_model) {
+				llama_free_model(draft_model);
+			}
+			draft_model = nullptr;
+		}
+	}
+
+	// workflows get a context of their own next to the dock one, with its own KV cache and
+	// threads on the same weights
+	const int n_background = plan.n_background;
+	struct llama_context *background_ctx = nullptr;
+	if (plan.background_n_ctx > 0) {
+		background_ctx = llama_init_context(model, config,
+						    (n_background + 1) * plan.background_n_ctx,
+						    config.background_n_threads);
+		if (background_ctx != nullptr) {
+			llama_warmup_context(background_ctx);
+		} else {
+			obs_log(LOG_WARNING,
+				"Failed to create the workflow context, workflows share the dock "
+				"context");
+		}
+	}
+	background_failed = config.background_context && background_ctx == nullptr;
+
+	// what is reported in the dock: the sizes llama.cpp knows, the estimate of the rest
+	llm_memory_estimate memory;
+	memory.model_bytes = llama_model_size(model);
+	memory.compute_bytes = plan.memory.compute_bytes;
+	for (struct llama_context *c : {ctx, draft_ctx, background_ctx}) {
+		if (c != nullptr) {
+			memory.state_bytes += llama_get_state_size(c);
+		}
+	}
+	if (draft_model != nullptr) {
+		memory.model_bytes += llama_model_size(draft_model);
+	}
+	set_memory(memory, memory_budget(config));
+	obs_log(LOG_INFO, "Memory: %s", llm_memory_text(memory, memory_budget(config)).c_str());
+
+	// requests keep running on the old context until the scheduler switches. a quantized K
+	// cache cannot be shifted.
+	const bool kv_shift = llm_kv_cache_type(config.kv_cache_type) == GGML_TYPE_F16;
+	std::future<struct llama_context *> released_draft =
+		global_llm_context.scheduler->set_draft_context(draft_ctx);
+	std::future<struct llama_context *> released = global_llm_context.scheduler->set_context(
+		ctx, config.n_batch, plan.n_parallel, kv_shift);
+	std::future<struct llama_context *> released_background =
+		global_llm_context.background_scheduler->set_context(
+			background_ctx, config.n_batch, n_background, kv_shift);
+	if (background_ctx == nullptr) {
+		// nothing would ever run what was queued for the workflow context
+		global_llm_context.background_scheduler->cancel_queued();
+	}
+	struct llama_context *old_ctx = released.get();
+	struct llama_context *old_draft_ctx = released_draft.get();
+	struct llama_context *old_background_ctx = released_background.get();
+	global_llm_context.ctx_llama = ctx;
+	global_llm_context.background_ctx_llama = background_ctx;
+	global_llm_context.model_llama = model;
+	global_llm_context.draft_ctx_llama = draft_ctx;
+	global_llm_context.draft_model_llama = draft_model;
+	loaded_model_key = model_key(model_file_path, config);
+	loaded_draft_key = draft_model != nullptr ? model_key(draft_path, config) : "";
+	if (old_ctx != nullptr) {
+		llama_free(old_ctx);
+	}
+	if (old_draft_ctx != nullptr) {
+		llama_free(old_draft_ctx);
+	}
+	if (old_background_ctx != nullptr) {
+		llama_free(old_background_ctx);
+	}
+	if (old_model != nullptr && old_model != model) {
+		llama_free_model(old_model);
+	}
+	if (old_draft_model != nullptr && old_draft_model != draft_model) {
+		llama_free_model(old_draft_model);
+	}
+	obs_log(LOG_INFO, "LLM model %s from %s", serving ? "reloaded" : "loaded",
+		model_file_path.c_str());
+	return LLM_MODEL_READY;
+}
+
+static void loader()
+{
+	// warm-up and tuning run on this thread, measure them under the inference core set and
+	// priority
+	apply_inference_thread_policy();
+	for (;;) {
+		std::string path;
+		{
+			std::lock_guard<std::mutex> lock(status_mutex);
+			path = model_path;
+			reload_requested = false;
+		}
+		// one round loads with one set of settings, even if they change meanwhile
+		const llm_model_state state = load_model(path, *llm_config_snapshot());
+
+		// settings that changed during the load are applied with another round
+		llm_model_status status;
+		std::function<void(const llm_model_status &)> callback;
+		{
+			std::lock_guard<std::mutex> lock(status_mutex);
+			if (reload_requested) {
+				model_status.state = LLM_MODEL_LOADING;
+				model_status.progress = 0.0f;
+				continue;
+			}
+			model_status.state = state;
+			model_status.progress = state == LLM_MODEL_READY ? 1.0f : 0.0f;
+			status = model_status;
+			callback = status_callback;
+		}
+		notify_status(status, callback);
+		return;
+	}
+}
+
+// start the loader thread. a load that is running already picks up the new settings when it is
+// done, unless only an unloaded idle model should be woken up.
+static void start_loader(bool reload_idle_only)
+{
+	std::lock_guard<std::mutex> loader_lock(loader_mutex);
+	llm_model_status status;
+	std::function<void(const llm_model_status &)> callback;
+	{
+		std::lock_guard<std::mutex> lock(status_mutex);
+		if (reload_idle_only && model_status.state != LLM_MODEL_IDLE) {
+			return;
+		}
+		if (model_status.state == LLM_MODEL_LOADING ||
+		    model_status.state == LLM_MODEL_TUNING ||
+		    model_status.state == LLM_MODEL_WARMING) {
+			reload_requested = true;
+			return;
+		}
+		model_status.state = LLM_MODEL_LOADING;
+		model_status.progress = 0.0f;
+		status = model_status;
+		callback = status_callback;
+	}
+	notify_status(status, callback);
+
+	// the previous loader thread has finished once the state left loading and warming
+	if (loader_thread.joinable()) {
+		loader_thread.join();
+	}
+	loader_thread = std::thread(loader);
+}
+
+// detach the context from the scheduler once it drained and free it
+static void unload_model(bool free_model)
+{
+	if (global_llm_context.scheduler != nullptr) {
+		std::future<struct llama_context *> released_draft =
+			global_llm_context.scheduler->set_draft_context(nullptr);
+		struct llama_context *old_ctx =
+			global_llm_context.scheduler->set_context(nullptr).get();
+		struct llama_context *old_draft_ctx = released_draft.get();
+		struct llama_context *old_background_ctx =
+			global_llm_context.background_scheduler->set_context(nullptr).get();
+		if (old_ctx != nullptr) {
+			llama_free(old_ctx);
+		}
+		if (old_draft_ctx != nullptr) {
+			llama_free(old_draft_ctx);
+		}
+		if (old_background_ctx != nullptr) {
+			llama_free(old_background_ctx);
+		}
+	} else {
+		if (global_llm_context.ctx_llama != nullptr) {
+			llama_free(global_llm_context.ctx_llama);
+		}
+		if (global_llm_context.draft_ctx_llama != nullptr) {
+			llama_free(global_llm_context.draft_ctx_llama);
+		}
+		if (global_llm_context.background_ctx_llama != nullptr) {
+			llama_free(global_llm_context.background_ctx_llama);
+		}
+	}
+	global_llm_context.ctx_llama = nullptr;
+	global_llm_context.draft_ctx_llama = nullptr;
+	global_llm_context.background_ctx_llama = nullptr;
+
+	if (free_model && global_llm_context.model_llama != nullptr) {
+		llama_free_model(global_llm_context.model_llama);
+		global_llm_context.model_llama = nullptr;
+	}
+	if (free_model && global_llm_context.draft_model_llama != nullptr) {
+		llama_free_model(global_llm_context.draft_model_llama);
+		global_llm_context.draft_model_llama = nullptr;
+	}
+}
+
+static void idle_monitor()
+{
+	std::unique_lock<std::mutex> lock(idle_mutex);
+	while (!idle_cv.wait_for(lock, std::chrono::seconds(5),
+				 []() { return idle_thread_stopping; })) {
+		const std::shared_ptr<const llm_config_data> config = llm_config_snapshot();
+		const int idle_minutes = config->idle_unload_minutes;
+		if (idle_minutes <= 0 || global_llm_context.scheduler == nullptr) {
+			continue;
+		}
+		// both contexts are unloaded together, once neither has run a request for a while
+		const int64_t dock_idle_since = global_llm_context.scheduler->idle_since_us();
+		const int64_t background_idle_since =
+			global_llm_context.background_scheduler->idle_since_us();
+		const int64_t idle_since = std::max(dock_idle_since, background_idle_since);
+		if (dock_idle_since == 0 || background_idle_since == 0 ||
+		    ggml_time_us() - idle_since < (int64_t)idle_minutes * 60 * 1000000) {
+			continue;
+		}
+
+		{
+			// no load may start while the model is unloaded
+			std::lock_guard<std::mutex> loader_lock(loader_mutex);
+			if (llm_model_get_status().state != LLM_MODEL_READY) {
+				continue;
+			}
+			obs_log(LOG_INFO, "LLM idle for %d minutes, unloading the %s",
+				idle_minutes,
+				config->idle_unload_model ? "model" : "context");
+			unload_model(config->idle_unload_model);
+			set_status(LLM_MODEL_IDLE, 0.0f);
+		}
+
+		// a request that came in while unloading did not see the idle state
+		if (global_llm_context.scheduler->queued() > 0 ||
+		    global_llm_context.background_scheduler->queued() > 0) {
+			start_loader(true);
+		}
+	}
+}
+
+static void set_throttle(const inference_throttle &throttle)
+{
+	global_llm_context.scheduler->set_throttle(throttle);
+	global_llm_context.background_scheduler->set_throttle(throttle);
+}
+
+void llm_model_load_async(const std::string &model_file_path)
+{
+	{
+		std::lock_guard<std::mutex> lock(status_mutex);
+		model_path = model_file_path;
+	}
+
+	if (global_llm_context.scheduler == nullptr) {
+		const std::shared_ptr<const llm_config_data> config = llm_config_snapshot();
+		// all requests to the context go through a single inference thread, they stay
+		// queued until the model is loaded
+		global_llm_context.scheduler =
+			new inference_scheduler(nullptr, config->n_batch, config->n_parallel);
+		global_llm_context.scheduler->set_wakeup_callback([]() { start_loader(true); });
+		global_llm_context.scheduler->set_metrics_callback(inference_metrics_record);
+		global_llm_context.scheduler->set_prefix_state_callbacks(session_state_load,
+									 session_state_save);
+		// the workflow context, when enabled, is loaded and unloaded with the dock one
+		global_llm_context.background_scheduler = new inference_scheduler(
+			nullptr, config->n_batch, std::max(config->workflow_max_concurrency, 1));
+		global_llm_context.background_scheduler->set_wakeup_callback(
+			[]() { start_loader(true); });
+		global_llm_context.background_scheduler->set_metrics_callback(
+			inference_metrics_record);
+		global_llm_context.background_scheduler->set_prefix_state_callbacks(
+			session_state_load, session_state_save);
+		// the stream comes first, both contexts are held back while OBS drops frames
+		inference_governor_start(obs_health_source_libobs(), set_throttle);
+	}
+
+	start_loader(false);
+
+	std::lock_guard<std::mutex> lock(idle_mutex);
+	if (!idle_thread.joinable()) {
+		idle_thread_stopping = false;
+		idle_thread = std::thread(idle_monitor);
+	}
+}
+
+void llm_model_shutdown()
+{
+	llm_model_set_status_callback(nullptr);
+
+	{
+		std::lock_guard<std::mutex> lock(idle_mutex);
+		idle_thread_stopping = true;
+	}
+	idle_cv.notify_all();
+	if (idle_thread.joinable()) {
+		idle_thread.join();
+	}
+
+	// a reload waits for the running requests to drain, which an endless generation never
+	// does: the requests are cancelled first, then the loader can finish
+	inference_governor_stop();
+	if (global_llm_context.scheduler != nullptr) {
+		global_llm_context.scheduler->stop();
+		global_llm_context.background_scheduler->stop();
+	}
+	{
+		std::lock_guard<std::mutex> lock(loader_mutex);
+		if (loader_thread.joinable()) {
+			loader_thread.join();
+		}
+	}
+
+	if (global_llm_context.scheduler != nullptr) {
+		delete global_llm_context.scheduler;
+		global_llm_context.scheduler = nullptr;
+		delete global_llm_context.background_scheduler;
+		global_llm_context.background_scheduler = nullptr;
+	}
+	session_state_flush();
+	if (global_llm_context.ctx_llama != nullptr) {
+		llama_free(global_llm_context.ctx_llama);
+		global_llm_context.ctx_llama = nullptr;
+	}
+	if (global_llm_context.background_ctx_llama != nullptr) {
+		llama_free(global_llm_context.background_ctx_llama);
+		global_llm_context.background_ctx_llama = nullptr;
+	}
+	if (global_llm_context.model_llama != nullptr) {
+		llama_free_model(global_llm_context.model_llama);
+		global_llm_context.model_llama = nullptr;
+	}
+	if (global_llm_context.draft_ctx_llama != nullptr) {
+		llama_free(global_llm_context.draft_ctx_llama);
+		global_llm_context.draft_ctx_llama = nullptr;
+	}
+	if (global_llm_context.draft_model_llama != nullptr) {
+		llama_free_model(global_llm_context.draft_model_llama);
+		global_llm_context.draft_model_llama = nullptr;
+	}
+	loaded_model_key.clear();
+	loaded_draft_key.clear();
+	llama_backend_free();
+
+	std::lock_guard<std::mutex> lock(status_mutex);
+	model_status = llm_model_status();
+}
+
+inference_scheduler *llm_background_scheduler()
+{
+	if (llm_config_snapshot()->background_context && !background_failed) {
+		return global_llm_context.background_scheduler;
+	}
+	return global_llm_context.scheduler;
+}
+
+llm_model_status llm_model_get_status()
+{
+	std::lock_guard<std::mutex> lock(status_mutex);
+	return model_status;
+}
+
+void llm_model_set_status_callback(std::function<void(const llm_model_status &)> callback)
+{
+	std::lock_guard<std::mutex> lock(status_mutex);
+	status_callback = callback;
+}
+
+std::string llm_model_status_text(const llm_model_status &status)
+{
+	switch (status.state) {
+	case LLM_MODEL_LOADING:
+		return "Loading model: " + std::to_string((int)(status.progress * 100)) + "%";
+	case LLM_MODEL_TUNING:
+		return "Measuring the speed of thread counts";
+	case LLM_MODEL_WARMING:
+		return "Warming up model";
+	case LLM_MODEL_FAILED:
+		if (status.memory_budget > 0) {
+			return "The model does not fit into the memory budget: " +
+			       llm_memory_text(status.memory, status.memory_budget);
+		}
+		return "Failed to load the model";
+	case LLM_MODEL_UNLOADED:
+		return "No model loaded";
+	case LLM_MODEL_IDLE:
+		return "Model unloaded while idle, it loads again on the next request";
+	case LLM_MODEL_READY:
+		if (status.memory.total() > 0) {
+			return "Memory: " + llm_memory_text(status.memory, status.memory_budget);
+		}
+		return "";
+	default:
+		return "";
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <functional>
+#include <string>
+
+#include "memory-budget.h"
+
+class inference_scheduler;
+
+enum llm_model_state {
+	LLM_MODEL_UNLOADED,
+	LLM_MODEL_LOADING,
+	LLM_MODEL_WARMING,
+	LLM_MODEL_READY,
+	LLM_MODEL_FAILED,
+	// unloaded after being idle, reloads on the next request
+	LLM_MODEL_IDLE,
+	// measuring the generation speed at several thread counts
+	LLM_MODEL_TUNING,
+};
+
+struct llm_model_status {
+	llm_model_state state = LLM_MODEL_UNLOADED;
+	// load progress (0..1) while loading
+	float progress = 0.0f;
+	// measured once ready, the estimate of the smallest contexts when the model did not fit
+	// into the memory budget
+	llm_memory_estimate memory;
+	uint64_t memory_budget = 0;
+};
+
+// Load the model on a background thread, warm it up and only then hand the context to the
+// scheduler, so requests queued in the meantime never see a cold or half-loaded context.
+// Once loaded, the context (and optionally the model) is freed after the configured idle time
+// and loaded again when the next request is queued.
+void llm_model_load_async(const std::string &model_file_path);
+
+// stop the loader and the idle monitor, stop the scheduler and free the context and the model
+void llm_model_shutdown();
+
+llm_model_status llm_model_get_status();
+
+// the scheduler of background requests: the one of the workflow context when it is enabled and
+// could be created, the dock scheduler otherwise
+inference_scheduler *llm_background_scheduler();
+
+// the callback is called from the loader thread on every state change and progress update
+void llm_model_set_status_callback(std::function<void(const llm_model_status &)> callback);
+
+// human readable status for the dock
+std::string llm_model_status_text(const llm_model_status &status);
+
+#endif // MODEL_LOADER_H
@@ -0,0 +1,250 @@
+#include "response-cache.h"
+#include "llama-inference.h"
+#include "llama-sampler.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+
+#include <obs-module.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// the disk store is trimmed to the budget after this many new files
+static const int DISK_TRIM_INTERVAL = 32;
+
+struct cache_entry {
+	uint64_t hash;
+	// the full key, a hash match alone is not trusted
+	std::string key;
+	std::string text;
+};
+
+static std::mutex cache_mutex;
+// most recently used first
+static std::list<cache_entry> entries;
+static std::unordered_map<uint64_t, std::list<cache_entry>::iterator> entry_index;
+static size_t cache_bytes = 0;
+static int puts_since_trim = 0;
+
+static uint64_t fnv1a(const std::string &text)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (const char c : text) {
+		hash ^= (unsigned char)c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static size_t max_bytes(const llm_config_data &config)
+{
+	return (size_t)std::max(config.response_cache_mb, 0) * 1024 * 1024;
+}
+
+// length prefixed, so fields cannot run into each other
+static void add_field(std::string &key, const std::string &value)
+{
+	key += std::to_string(value.size());
+	key += ':';
+	key += value;
+}
+
+std::string response_cache_key(const llm_config_data &config, const std::string &prompt)
+{
+	const llama_sampler_params params = llama_sampler_params_from_config(config);
+
+	std::string key;
+	add_field(key, llama_model_file_id(config.local_model_path));
+	add_field(key, config.system_prompt);
+	add_field(key, config.end_sequence);
+	for (const std::string &stop : config.stop_sequences) {
+		add_field(key, stop);
+	}
+	add_field(key, std::to_string(params.temperature));
+	add_field(key, std::to_string(params.top_k));
+	add_field(key, std::to_string(params.top_p));
+	add_field(key, std::to_string(params.repeat_penalty));
+	add_field(key, std::to_string(params.repeat_last_n));
+	add_field(key, std::to_string(config.max_output_tokens));
+	add_field(key, prompt);
+	return key;
+}
+
+static std::filesystem::path disk_folder()
+{
+	char *path = obs_module_config_path("response-cache");
+	if (path == nullptr) {
+		return std::filesystem::path();
+	}
+	const std::filesystem::path folder = std::filesystem::u8path(path);
+	bfree(path);
+	return folder;
+}
+
+static std::filesystem::path disk_path(const std::filesystem::path &folder, uint64_t hash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016" PRIx64 ".bin", hash);
+	return folder / name;
+}
+
+// file format: the key length as text, a line break, the key and the text
+static bool read_disk(uint64_t hash, const std::string &key, std::string &text)
+{
+	const std::filesystem::path folder = disk_folder();
+	if (folder.empty()) {
+		return false;
+	}
+	const std::filesystem::path path = disk_path(folder, hash);
+	std::ifstream file(path, std::ios::binary);
+	size_t key_size = 0;
+	if (!(file >> key_size) || file.get() != '\n' || key_size != key.size()) {
+		return false;
+	}
+	std::string stored_key(key_size, '\0');
+	if (!file.read(&stored_key[0], (std::streamsize)key_size) || stored_key != key) {
+		return false;
+	}
+	text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	file.close();
+	// the modification time orders the files for trimming
+	std::error_code ec;
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+	return true;
+}
+
+// remove the least recently used files until the folder fits into the budget
+static void trim_disk(const std::filesystem::path &folder, size_t budget)
+{
+	struct disk_file {
+		std::filesystem::file_time_type time;
+		uintmax_t size;
+		std::filesystem::path path;
+	};
+	std::vector<disk_file> files;
+	uintmax_t total = 0;
+	std::error_code ec;
+	for (const auto &entry : std::filesystem::directory_iterator(folder, ec)) {
+		disk_file file{entry.last_write_time(ec), entry.file_size(ec), entry.path()};
+		if (!ec) {
+			total += file.size;
+			files.push_back(std::move(file));
+		}
+	}
+	if (total <= budget) {
+		return;
+	}
+	std::sort(files.begin(), files.end(),
+		  [](const disk_file &a, const disk_file &b) { return a.time < b.time; });
+	for (const disk_file &file : files) {
+		if (total <= budget) {
+			break;
+		}
+		if (std::filesystem::remove(file.path, ec)) {
+			total -= file.size;
+		}
+	}
+}
+
+static void write_disk(uint64_t hash, const std::string &key, const std::string &text)
+{
+	const std::filesystem::path folder = disk_folder();
+	if (folder.empty()) {
+		return;
+	}
+	std::error_code ec;
+	std::filesystem::create_directories(folder, ec);
+	const std::filesystem::path path = disk_path(folder, hash);
+	std::filesystem::path tmp_path = path;
+	tmp_path += ".tmp";
+	{
+		std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+		file << key.size() << '\n';
+		file.write(key.data(), (std::streamsize)key.size());
+		file.write(text.data(), (std::streamsize)text.size());
+		if (!file) {
+			obs_log(LOG_WARNING, "Failed to write the response cache file %s",
+				tmp_path.u8string().c_str());
+			return;
+		}
+	}
+	std::filesystem::rename(tmp_path, path, ec);
+}
+
+// insert as most recently used and evict from the back beyond budget, with cache_mutex held
+static void insert(uint64_t hash, const std::string &key, const std::string &text, size_t budget)
+{
+	auto found = entry_index.find(hash);
+	if (found != entry_index.end()) {
+		cache_bytes -= found->second->key.size() + found->second->text.size();
+		entries.erase(found->second);
+		entry_index.erase(found);
+	}
+	entries.push_front(cache_entry{hash, key, text});
+	entry_index[hash] = entries.begin();
+	cache_bytes += key.size() + text.size();
+	while (cache_bytes > budget && !entries.empty()) {
+		const cache_entry &last = entries.back();
+		cache_bytes -= last.key.size() + last.text.size();
+		entry_index.erase(last.hash);
+		entries.pop_back();
+	}
+}
+
+bool response_cache_get(const std::string &key, std::string &text)
+{
+	const std::shared_ptr<const llm_config_data> config = llm_config_snapshot();
+	const uint64_t hash = fnv1a(key);
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		auto found = entry_index.find(hash);
+		if (found != entry_index.end() && found->second->key == key) {
+			entries.splice(entries.begin(), entries, found->second);
+			text = found->second->text;
+			return true;
+		}
+	}
+	if (!config->response_cache_disk || !read_disk(hash, key, text)) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	insert(hash, key, text, max_bytes(*config));
+	return true;
+}
+
+void response_cache_put(const std::string &key, const std::string &text)
+{
+	// the disk flag and the budget are read once, the settings may change meanwhile
+	const std::shared_ptr<const llm_config_data> config = llm_config_snapshot();
+	const uint64_t hash = fnv1a(key);
+	bool trim = false;
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		insert(hash, key, text, max_bytes(*config));
+		if (config->response_cache_disk && ++puts_since_trim >= DISK_TRIM_INTERVAL) {
+			puts_since_trim = 0;
+			trim = true;
+		}
+	}
+	if (!config->response_cache_disk) {
+		return;
+	}
+	write_disk(hash, key, text);
+	if (trim) {
+		trim_disk(disk_folder(), max_bytes(*config));
+	}
+}
+
+void response_cache_clear()
+{
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	entries.clear();
+	entry_index.clear();
+	cache_bytes = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <string>
+
+// Generations of earlier requests, looked up by a key made of everything that determines the
+// output: the model file (path, size and modification time), the prompt template, the stop
+// strings, the sampling parameters and the prompt. Entries are kept in memory in LRU order
+// within response_cache_mb and, when enabled, as files in the response-cache folder of the
+// module config, trimmed to the same budget.
+
+struct llm_config_data;
+
+// key of a prompt for the model and settings of config
+std::string response_cache_key(const llm_config_data &config, const std::string &prompt);
+
+// look up a generation in memory, then on disk. false if it is not cached.
+bool response_cache_get(const std::string &key, std::string &text);
+
+// store a generation, in memory and on disk when enabled. writes files, so it should not be
+// called from the inference thread.
+void response_cache_put(const std::string &key, const std::string &text);
+
+// drop the in-memory entries
+void response_cache_clear();
+
+#endif // RESPONSE_CACHE_H
@@ -0,0 +1,328 @@
+#include "session-state.h"
+#include "llama-inference.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+
+#include <obs-module.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// older session files are removed beyond this many
+static const size_t SESSION_STATE_MAX_FILES = 4;
+static const char SESSION_STATE_MAGIC[4] = {'L', 'D', 'S', 'S'};
+static const uint32_t SESSION_STATE_VERSION = 1;
+
+// followed by n_tokens prefix tokens and data_size bytes of llama state
+struct session_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t model_hash;
+	uint64_t prompt_hash;
+	// llama_get_state_size() of the context that saved it, restoring the state into a
+	// context with another KV buffer layout would abort
+	uint64_t state_size;
+	uint64_t data_size;
+	uint64_t n_tokens;
+};
+
+static std::mutex model_mutex;
+static const struct llama_model *registered_model = nullptr;
+static std::string registered_model_id;
+
+static std::mutex writer_mutex;
+static std::thread writer;
+static std::atomic<bool> writing{false};
+
+static uint64_t fnv1a(const void *data, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= ((const unsigned char *)data)[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// read-only mapping of a whole file, the state is restored straight from the page cache
+class mapped_file {
+public:
+	~mapped_file()
+	{
+#ifdef _WIN32
+		if (data != nullptr) {
+			UnmapViewOfFile(data);
+		}
+#else
+		if (data != nullptr) {
+			munmap((void *)data, size);
+		}
+#endif
+	}
+
+	bool open(const std::filesystem::path &path)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+					  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+			CloseHandle(file);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (mapping == NULL) {
+			return false;
+		}
+		data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		size = (size_t)file_size.QuadPart;
+		return data != nullptr;
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			close(fd);
+			return false;
+		}
+		void *mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+		data = (const uint8_t *)mapped;
+		size = (size_t)st.st_size;
+		return true;
+#endif
+	}
+
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+};
+
+void session_state_set_model(const struct llama_model *model, const std::string &model_file_path)
+{
+	// a freed model may be followed by another one at the same address, which is registered
+	// here before any context of it is used
+	std::lock_guard<std::mutex> lock(model_mutex);
+	registered_model = model;
+	registered_model_id = llama_model_file_id(model_file_path);
+}
+
+// false if the model of the context was not registered, e.g. while the previous model still
+// finishes its requests during a reload
+static bool model_hash(struct llama_context *ctx, uint64_t &hash)
+{
+	std::lock_guard<std::mutex> lock(model_mutex);
+	if (registered_model == nullptr || llama_get_model(ctx) != registered_model) {
+		return false;
+	}
+	const std::string id = registered_model_id + "|" + std::to_string(llama_n_ctx(ctx));
+	hash = fnv1a(id.data(), id.size());
+	return true;
+}
+
+static std::filesystem::path session_folder()
+{
+	char *path = obs_module_config_path("sessions");
+	if (path == nullptr) {
+		return std::filesystem::path();
+	}
+	const std::filesystem::path folder = std::filesystem::u8path(path);
+	bfree(path);
+	return folder;
+}
+
+static std::filesystem::path session_path(const std::filesystem::path &folder,
+					  uint64_t model_hash, uint64_t prompt_hash)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "session-%016" PRIx64 "-%016" PRIx64 ".bin", model_hash,
+		 prompt_hash);
+	return folder / name;
+}
+
+bool session_state_load(struct llama_context *ctx, const std::vector<llama_token> &tokens)
+{
+	uint64_t hash = 0;
+	if (!llm_config_snapshot()->session_cache || tokens.empty() || !model_hash(ctx, hash)) {
+		return false;
+	}
+	const std::filesystem::path folder = session_folder();
+	if (folder.empty()) {
+		return false;
+	}
+	const size_t tokens_size = tokens.size() * sizeof(llama_token);
+	const std::filesystem::path path =
+		session_path(folder, hash, fnv1a(tokens.data(), tokens_size));
+
+	mapped_file file;
+	if (!file.open(path)) {
+		return false;
+	}
+	session_header header;
+	if (file.size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, file.data, sizeof(header));
+	const size_t state_size = llama_get_state_size(ctx);
+	if (memcmp(header.magic, SESSION_STATE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != SESSION_STATE_VERSION || header.model_hash != hash ||
+	    header.state_size != state_size || header.data_size > state_size ||
+	    header.n_tokens != tokens.size() ||
+	    file.size != sizeof(header) + tokens_size + header.data_size ||
+	    memcmp(file.data + sizeof(header), tokens.data(), tokens_size) != 0) {
+		obs_log(LOG_INFO, "%s: %s does not match the model or prompt, decoding the prefix",
+			__func__, path.u8string().c_str());
+		return false;
+	}
+
+	llama_set_state_data(ctx, const_cast<uint8_t *>(file.data + sizeof(header) + tokens_size));
+
+	// the modification time orders the files for trimming
+	std::error_code ec;
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+	obs_log(LOG_INFO, "%s: restored the prompt prefix of %d tokens from %s", __func__,
+		(int)tokens.size(), path.u8string().c_str());
+	return true;
+}
+
+// keep the newest SESSION_STATE_MAX_FILES session files
+static void trim_folder(const std::filesystem::path &folder)
+{
+	struct session_file {
+		std::filesystem::file_time_type time;
+		std::filesystem::path path;
+	};
+	std::vector<session_file> files;
+	std::error_code ec;
+	for (const auto &entry : std::filesystem::directory_iterator(folder, ec)) {
+		const std::string name = entry.path().filename().u8string();
+		if (name.rfind("session-", 0) != 0 || entry.path().extension() != ".bin") {
+			continue;
+		}
+		session_file file{entry.last_write_time(ec), entry.path()};
+		if (!ec) {
+			files.push_back(std::move(file));
+		}
+	}
+	if (files.size() <= SESSION_STATE_MAX_FILES) {
+		return;
+	}
+	std::sort(files.begin(), files.end(),
+		  [](const session_file &a, const session_file &b) { return a.time > b.time; });
+	for (size_t i = SESSION_STATE_MAX_FILES; i < files.size(); i++) {
+		std::filesystem::remove(files[i].path, ec);
+	}
+}
+
+static void write_state(const std::filesystem::path &folder, const std::filesystem::path &path,
+			const session_header &header, const std::vector<llama_token> &tokens,
+			const uint8_t *data)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(folder, ec);
+	std::filesystem::path tmp_path = path;
+	tmp_path += ".tmp";
+	{
+		std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+		file.write((const char *)&header, sizeof(header));
+		file.write((const char *)tokens.data(),
+			   (std::streamsize)(tokens.size() * sizeof(llama_token)));
+		file.write((const char *)data, (std::streamsize)header.data_size);
+		if (!file) {
+			obs_log(LOG_WARNING, "Failed to write the session state %s",
+				tmp_path.u8string().c_str());
+			file.close();
+			std::filesystem::remove(tmp_path, ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmp_path, path, ec);
+	if (ec) {
+		std::filesystem::remove(tmp_path, ec);
+		return;
+	}
+	obs_log(LOG_INFO, "Saved the prompt prefix state to %s (%.1f MB)", path.u8string().c_str(),
+		header.data_size / (1024.0 * 1024.0));
+	trim_folder(folder);
+}
+
+void session_state_save(struct llama_context *ctx, const std::vector<llama_token> &tokens)
+{
+	uint64_t hash = 0;
+	if (!llm_config_snapshot()->session_cache || tokens.empty() || !model_hash(ctx, hash)) {
+		return;
+	}
+	// the inference thread never waits for the disk, a prefix decoded while the previous
+	// state is still being written is saved the next time it is decoded
+	if (writing) {
+		return;
+	}
+	const std::filesystem::path folder = session_folder();
+	if (folder.empty()) {
+		return;
+	}
+
+	session_header header;
+	memcpy(header.magic, SESSION_STATE_MAGIC, sizeof(header.magic));
+	header.version = SESSION_STATE_VERSION;
+	header.model_hash = hash;
+	header.prompt_hash = fnv1a(tokens.data(), tokens.size() * sizeof(llama_token));
+	header.state_size = llama_get_state_size(ctx);
+	header.n_tokens = tokens.size();
+
+	// the size covers the whole KV buffer, but only the cells up to the KV head are copied,
+	// so the pages past them are never touched
+	std::unique_ptr<uint8_t[]> data(new (std::nothrow) uint8_t[header.state_size]);
+	if (!data) {
+		return;
+	}
+	header.data_size = llama_copy_state_data(ctx, data.get());
+
+	std::lock_guard<std::mutex> lock(writer_mutex);
+	if (writer.joinable()) {
+		writer.join();
+	}
+	writing = true;
+	writer = std::thread(
+		[folder, header, tokens](std::unique_ptr<uint8_t[]> data) {
+			write_state(folder, session_path(folder, header.model_hash,
+							 header.prompt_hash),
+				    header, tokens, data.get());
+			writing = false;
+		},
+		std::move(data));
+}
+
+void session_state_flush()
+{
+	std::lock_guard<std::mutex> lock(writer_mutex);
+	if (writer.joinable()) {
+		writer.join();
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef SESSION_STATE_H
+#define SESSION_STATE_H
+
+#include <string>
+#include <vector>
+
+#include <llama.h>
+
+// The llama state (KV cache, logits and RNG) after decoding the prompt template prefix, kept in
+// the sessions folder of the module config so that a restart skips decoding the prefix again.
+// Files are named after a hash of the model (file identity, context size) and a hash of the
+// prefix tokens, and are checked against both before they are restored. Only the newest
+// SESSION_STATE_MAX_FILES files are kept.
+// The state covers the whole context, so it may only be saved or restored while no sequence
+// other than the prefix has cells in the KV cache.
+
+// the model file that was loaded into model, so states of other models are never restored
+// into its contexts. a model that was not registered is not cached.
+void session_state_set_model(const struct llama_model *model, const std::string &model_file_path);
+
+// restore the state saved for the prefix tokens, from the inference thread. false if there is
+// none or it does not match the context, the context is unchanged then.
+bool session_state_load(struct llama_context *ctx, const std::vector<llama_token> &tokens);
+
+// copy the state of the context and write it out on a background thread, from the inference
+// thread right after the prefix tokens were decoded
+void session_state_save(struct llama_context *ctx, const std::vector<llama_token> &tokens);
+
+// wait for a state that is being written
+void session_state_flush();
+
+#endif // SESSION_STATE_H
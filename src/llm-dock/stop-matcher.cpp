@@ -0,0 +1,112 @@
+#include "stop-matcher.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+
+#include <obs-module.h>
+
+#include <algorithm>
+
+stop_matcher::stop_matcher(const std::vector<std::string> &stop_strings,
+			   const std::string &stop_regex, size_t regex_window_)
+	: regex_window(regex_window_)
+{
+	for (const std::string &stop : stop_strings) {
+		if (!stop.empty()) {
+			stops.push_back(stop);
+		}
+	}
+	if (!stop_regex.empty()) {
+		try {
+			regex = std::regex(stop_regex);
+			has_regex = true;
+		} catch (const std::regex_error &e) {
+			obs_log(LOG_WARNING, "Invalid end sequence regex '%s': %s",
+				stop_regex.c_str(), e.what());
+		}
+	}
+}
+
+void stop_matcher::reset()
+{
+	pending.clear();
+	tail.clear();
+	is_stopped = false;
+}
+
+std::string stop_matcher::emit(size_t n)
+{
+	std::string text = pending.substr(0, n);
+	pending.erase(0, n);
+	tail += text;
+	if (tail.size() > regex_window) {
+		tail.erase(0, tail.size() - regex_window);
+	}
+	return text;
+}
+
+std::string stop_matcher::feed(const std::string &piece)
+{
+	if (is_stopped) {
+		return "";
+	}
+
+	// only the new bytes (plus the held back text) can contain the start of a stop string
+	pending += piece;
+
+	size_t stop_pos = std::string::npos;
+	for (const std::string &stop : stops) {
+		stop_pos = std::min(stop_pos, pending.find(stop));
+	}
+	if (stop_pos != std::string::npos) {
+		is_stopped = true;
+		return emit(stop_pos);
+	}
+
+	if (has_regex) {
+		const std::string window = tail + pending;
+		std::smatch match;
+		if (std::regex_search(window, match, regex)) {
+			is_stopped = true;
+			const size_t match_pos = (size_t)match.position(0);
+			return match_pos > tail.size() ? emit(match_pos - tail.size()) : "";
+		}
+	}
+
+	// hold back the longest suffix that is a prefix of a stop string
+	size_t hold = 0;
+	for (const std::string &stop : stops) {
+		for (size_t n = std::min(stop.size() - 1, pending.size()); n > hold; n--) {
+			if (pending.compare(pending.size() - n, n, stop, 0, n) == 0) {
+				hold = n;
+				break;
+			}
+		}
+	}
+	return emit(pending.size() - hold);
+}
+
+std::string stop_matcher::flush()
+{
+	if (is_stopped) {
+		return "";
+	}
+	return emit(pending.size());
+}
+
+// an end sequence without regex syntax is matched literally, so it can be held back
+static bool is_literal(const std::string &pattern)
+{
+	return pattern.find_first_of("\\^$.|?*+()[]{}") == std::string::npos;
+}
+
+stop_matcher stop_matcher_from_config(const llm_config_data &config)
+{
+	std::vector<std::string> stop_strings = config.stop_sequences;
+	std::string stop_regex;
+	if (is_literal(config.end_sequence)) {
+		stop_strings.push_back(config.end_sequence);
+	} else {
+		stop_regex = config.end_sequence;
+	}
+	return stop_matcher(stop_strings, stop_regex);
+}
@@ -0,0 +1,49 @@
+#ifndef STOP_MATCHER_H
+#define STOP_MATCHER_H
+
+#include <regex>
+#include <string>
+#include <vector>
+
+/**
+  * @brief Streaming matcher for generation stop sequences.
+  * Literal stop strings are matched incrementally on the newly appended text. Text that could
+  * still turn into a stop string is held back, so stop text is never emitted. An optional
+  * regular expression, compiled once, is checked on a bounded window at the end of the output.
+  */
+class stop_matcher {
+public:
+	stop_matcher(const std::vector<std::string> &stop_strings, const std::string &stop_regex = "",
+		     size_t regex_window = 256);
+
+	// append a generated piece and return the text that is safe to emit
+	std::string feed(const std::string &piece);
+
+	// return the held back text once the generation ended without a stop
+	std::string flush();
+
+	bool stopped() const { return is_stopped; }
+
+	// forget the output of the previous generation
+	void reset();
+
+private:
+	std::string emit(size_t n);
+
+	std::vector<std::string> stops;
+	bool has_regex = false;
+	std::regex regex;
+	size_t regex_window;
+	// text that may be the start of a stop string
+	std::string pending;
+	// the last emitted text, for matching the regular expression across pieces
+	std::string tail;
+	bool is_stopped = false;
+};
+
+struct llm_config_data;
+
+// build a stop matcher from the end sequence and stop strings of the settings
+stop_matcher stop_matcher_from_config(const llm_config_data &config);
+
+#endif // STOP_MATCHER_H
@@ -0,0 +1,65 @@
+#include "text-source-sink.h"
+
+// at most 10 updates per second, a caption does not need to change more often than it is read
+static const int64_t TEXT_SINK_INTERVAL_MS = 100;
+
+text_source_sink::text_source_sink(const std::string &source_name) : source_name(source_name)
+{
+	settings = obs_data_create();
+}
+
+text_source_sink::~text_source_sink()
+{
+	obs_weak_source_release(weak_source);
+	obs_data_release(settings);
+}
+
+void text_source_sink::set_text(const std::string &text)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	pending = text;
+	dirty = true;
+}
+
+obs_source_t *text_source_sink::get_source()
+{
+	obs_source_t *source = obs_weak_source_get_source(weak_source);
+	if (source != nullptr) {
+		return source;
+	}
+	// not looked up yet, or removed and maybe added again under the same name
+	obs_weak_source_release(weak_source);
+	weak_source = nullptr;
+	source = obs_get_source_by_name(source_name.c_str());
+	if (source != nullptr) {
+		weak_source = obs_source_get_weak_source(source);
+	}
+	return source;
+}
+
+void text_source_sink::flush(int64_t now_us, bool force)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!dirty || (!force && now_us - last_update_us < TEXT_SINK_INTERVAL_MS * 1000)) {
+			return;
+		}
+		dirty = false;
+		if (pending == shown) {
+			return;
+		}
+		// assigning reuses the capacity of shown
+		shown = pending;
+	}
+
+	obs_source_t *source = get_source();
+	if (source == nullptr) {
+		// shown again with the next text once the source exists
+		shown.clear();
+		return;
+	}
+	obs_data_set_string(settings, "text", shown.c_str());
+	obs_source_update(source, settings);
+	obs_source_release(source);
+	last_update_us = now_us;
+}
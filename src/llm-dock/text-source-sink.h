@@ -0,0 +1,45 @@
+#ifndef TEXT_SOURCE_SINK_H
+#define TEXT_SOURCE_SINK_H
+
+#include <obs-module.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+  * @brief Writes generated text into an OBS text source at a capped rate.
+  * Every obs_source_update makes the text source render its texture again, so streamed pieces
+  * only replace the pending text, and flush() updates the source at most every
+  * TEXT_SINK_INTERVAL_MS and only when the text differs from what it shows. The same
+  * obs_data_t and a weak reference to the source are kept between updates.
+  */
+class text_source_sink {
+public:
+	explicit text_source_sink(const std::string &source_name);
+	~text_source_sink();
+
+	// replace the text to show, may be called from any thread
+	void set_text(const std::string &text);
+
+	// update the source if the text changed and the last update is long enough ago, or
+	// regardless of the time with force. called from one thread only.
+	void flush(int64_t now_us, bool force = false);
+
+private:
+	obs_source_t *get_source();
+
+	std::string source_name;
+
+	std::mutex mutex;
+	std::string pending;
+	bool dirty = false;
+
+	// only touched by the flushing thread
+	std::string shown;
+	int64_t last_update_us = 0;
+	obs_data_t *settings = nullptr;
+	obs_weak_source_t *weak_source = nullptr;
+};
+
+#endif // TEXT_SOURCE_SINK_H
@@ -0,0 +1,146 @@
+#include "thread-policy.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+
+#include <obs-module.h>
+
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#else
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool parse_cpu_set(const std::string &text, std::vector<int> &cpus)
+{
+	cpus.clear();
+	// core ids beyond the cores of the machine are a typo, e.g. 0-100000
+	const int n_cores = std::max((int)std::thread::hardware_concurrency(), 1);
+	std::istringstream ss(text);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+		if (range.empty()) {
+			continue;
+		}
+		int first = 0;
+		int last = 0;
+		try {
+			const size_t dash = range.find('-');
+			first = std::stoi(range.substr(0, dash));
+			last = dash == std::string::npos ? first
+							 : std::stoi(range.substr(dash + 1));
+		} catch (const std::exception &) {
+			return false;
+		}
+		if (first < 0 || last < first || last >= n_cores) {
+			return false;
+		}
+		for (int cpu = first; cpu <= last; cpu++) {
+			cpus.push_back(cpu);
+		}
+	}
+	std::sort(cpus.begin(), cpus.end());
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+	return true;
+}
+
+int inference_core_count(const llm_config_data &config)
+{
+	std::vector<int> cpus;
+	if (parse_cpu_set(config.cpu_affinity, cpus) && !cpus.empty()) {
+		return (int)cpus.size();
+	}
+	return std::max((int)std::thread::hardware_concurrency(), 1);
+}
+
+static void set_thread_affinity(const std::vector<int> &cpus)
+{
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (int cpu : cpus) {
+		if (cpu < (int)(sizeof(DWORD_PTR) * 8)) {
+			mask |= (DWORD_PTR)1 << cpu;
+		}
+	}
+	// only the cores OBS may run on, all of them if none of the configured ones
+	DWORD_PTR process_mask = 0;
+	DWORD_PTR system_mask = 0;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) != 0) {
+		mask &= process_mask;
+		if (mask == 0) {
+			mask = process_mask;
+		}
+	}
+	if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+		obs_log(LOG_WARNING, "%s: SetThreadAffinityMask failed", __func__);
+	}
+#elif defined(__APPLE__)
+	if (!cpus.empty()) {
+		obs_log(LOG_WARNING, "%s: pinning inference threads is not supported on macOS",
+			__func__);
+	}
+#else
+	// only the cores OBS may run on, all of them if none of the configured ones
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(getpid(), sizeof(allowed), &allowed) != 0) {
+		for (int cpu = 0; cpu < (int)std::thread::hardware_concurrency(); cpu++) {
+			CPU_SET(cpu, &allowed);
+		}
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus) {
+		if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	if (CPU_COUNT(&set) == 0) {
+		if (!cpus.empty()) {
+			obs_log(LOG_WARNING, "%s: none of the configured cores is available",
+				__func__);
+		}
+		set = allowed;
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		obs_log(LOG_WARNING, "%s: sched_setaffinity failed", __func__);
+	}
+#endif
+}
+
+static void set_thread_low_priority(bool low)
+{
+#ifdef _WIN32
+	SetThreadPriority(GetCurrentThread(),
+			  low ? THREAD_PRIORITY_BELOW_NORMAL : THREAD_PRIORITY_NORMAL);
+#elif defined(__APPLE__)
+	pthread_set_qos_class_self_np(low ? QOS_CLASS_UTILITY : QOS_CLASS_USER_INITIATED, 0);
+#else
+	// the nice value is per thread on Linux. going back up may be refused without privileges.
+	if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), low ? 10 : 0) != 0 && low) {
+		obs_log(LOG_WARNING, "%s: setpriority failed", __func__);
+	}
+#endif
+}
+
+void apply_inference_thread_policy()
+{
+	const std::shared_ptr<const llm_config_data> config = llm_config_snapshot();
+	std::vector<int> cpus;
+	if (!parse_cpu_set(config->cpu_affinity, cpus)) {
+		obs_log(LOG_WARNING, "%s: invalid core list '%s', not pinning", __func__,
+			config->cpu_affinity.c_str());
+		cpus.clear();
+	}
+	set_thread_affinity(cpus);
+	set_thread_low_priority(config->low_priority);
+}
@@ -0,0 +1,25 @@
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#include <string>
+#include <vector>
+
+// parse a core list such as "0-3,6" into core ids, returns false if the list is malformed or
+// names a core the machine does not have
+bool parse_cpu_set(const std::string &text, std::vector<int> &cpus);
+
+struct llm_config_data;
+
+// number of cores inference may run on: the core set of config, or all cores
+int inference_core_count(const llm_config_data &config);
+
+/**
+  * @brief Apply the configured core set and priority to the calling thread.
+  * Called on the threads that run llama_decode. On Linux the compute threads ggml starts from
+  * there inherit both, so the whole inference stays off the cores and out of the way of the
+  * encoder and render threads. On Windows only the calling thread is pinned, on macOS the
+  * priority is lowered through the QoS class and pinning is not supported.
+  */
+void apply_inference_thread_policy();
+
+#endif // THREAD_POLICY_H
@@ -0,0 +1,556 @@
+#include "workflow-engine.h"
+#include "inference-scheduler.h"
+#include "llama-inference.h"
+#include "model-loader.h"
+#include "plugin-support.h"
+#include "llm-config-data.h"
+#include "file-watcher.h"
+#include "text-source-sink.h"
+#include "file-sink.h"
+#include "response-cache.h"
+#include "inference-metrics.h"
+
+#include <obs-module.h>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// resolution of the timer wheel
+static const int WORKFLOW_TICK_MS = 20;
+// timers further out than this many ticks wait for more rounds of the wheel
+static const size_t WORKFLOW_WHEEL_SLOTS = 256;
+// on-change workflows look at their input at least this often
+static const int WORKFLOW_POLL_MS = 250;
+// shortest period of periodic workflows
+static const int WORKFLOW_MIN_PERIOD_MS = 100;
+
+static workflow_io_type parse_io_type(const std::string &selection, const char *none_item,
+				      const char *file_item)
+{
+	if (selection.empty() || selection == none_item) {
+		return WORKFLOW_IO_NONE;
+	}
+	if (selection == file_item) {
+		return WORKFLOW_IO_FILE;
+	}
+	// any other entry is the name of a text source
+	return WORKFLOW_IO_TEXT_SOURCE;
+}
+
+bool workflow_from_json(const std::string &json, workflow &wf)
+{
+	const nlohmann::json j = nlohmann::json::parse(json, nullptr, false);
+	if (j.is_discarded() || !j.is_object()) {
+		return false;
+	}
+	wf.prompt = j.value("prompt", std::string());
+	const std::string source = j.value("source", std::string());
+	wf.source_type = parse_io_type(source, "None / No Input", "File Input");
+	wf.source = wf.source_type == WORKFLOW_IO_FILE ? j.value("sourceFile", std::string())
+						       : source;
+	wf.source_mode = j.value("sourceMode", std::string()) == "End of file"
+				 ? WORKFLOW_FILE_WINDOW
+				 : WORKFLOW_FILE_APPENDED;
+	const std::string target = j.value("target", std::string());
+	wf.target_type = parse_io_type(target, "None / No Output", "File Output");
+	wf.target = wf.target_type == WORKFLOW_IO_FILE ? j.value("targetFile", std::string())
+						       : target;
+	wf.target_mode = j.value("targetMode", std::string()) == "Append to file"
+				 ? WORKFLOW_OUTPUT_APPEND
+				 : WORKFLOW_OUTPUT_REPLACE;
+	wf.local = j.value("localOrCloud", std::string("Local")) != "Cloud";
+	wf.streaming = j.value("streaming", false);
+	wf.trigger = j.value("trigger_onChange_or_periodic", std::string()) == "On Change"
+			     ? WORKFLOW_TRIGGER_ON_CHANGE
+			     : WORKFLOW_TRIGGER_PERIODIC;
+	wf.trigger_ms = j.value("triggerMs", 100);
+	return true;
+}
+
+/**
+  * @brief Hashed timer wheel: timers are kept in the slot of the tick they expire on, with the
+  * number of full rounds still to wait. Scheduling is O(1) and a tick only looks at one slot,
+  * however many workflows there are.
+  */
+class timer_wheel {
+public:
+	timer_wheel() : slots(WORKFLOW_WHEEL_SLOTS) {}
+
+	// expire the timer of id after delay_ms, rounded up to whole ticks
+	void schedule(size_t id, int delay_ms)
+	{
+		const size_t ticks =
+			(size_t)std::max(1, (delay_ms + WORKFLOW_TICK_MS - 1) / WORKFLOW_TICK_MS);
+		slots[(cursor + ticks) % slots.size()].push_back({id, (ticks - 1) / slots.size()});
+	}
+
+	// advance by one tick and append the ids of the expired timers
+	void advance(std::vector<size_t> &expired)
+	{
+		cursor = (cursor + 1) % slots.size();
+		std::vector<timer> &slot = slots[cursor];
+		for (size_t i = 0; i < slot.size();) {
+			if (slot[i].rounds > 0) {
+				slot[i++].rounds--;
+				continue;
+			}
+			expired.push_back(slot[i].id);
+			slot[i] = slot.back();
+			slot.pop_back();
+		}
+	}
+
+private:
+	struct timer {
+		size_t id;
+		size_t rounds;
+	};
+
+	std::vector<std::vector<timer>> slots;
+	size_t cursor = 0;
+};
+
+struct workflow_state {
+	workflow wf;
+	// set while a request of this workflow is queued or generating
+	std::atomic<bool> running{false};
+	// set by workflow_engine_notify_change
+	std::atomic<bool> check_now{false};
+	// writes to a text source target, flushed by the workflow thread
+	std::unique_ptr<text_source_sink> text_sink;
+	// writes to a file target on its own thread
+	std::unique_ptr<file_sink> file_out;
+	// only touched by the workflow thread
+	// read position of a file source read in WORKFLOW_FILE_APPENDED mode
+	file_tail tail;
+	// on-change workflows: the last input read, or the text appended since the last run,
+	// and whether it changed since the last run and when
+	std::string input;
+	bool has_input = false;
+	bool pending = false;
+	int64_t changed_us = 0;
+};
+
+// serializes starting and stopping
+static std::mutex engine_mutex;
+static std::thread engine_thread;
+// cancels the requests of the running workflows when the engine stops
+static cancellation_token engine_cancel;
+// workflows currently queued or generating, also of a previous start
+static std::atomic<int> n_running{0};
+// reports writes to the files of on-change workflows
+static std::unique_ptr<file_watcher> watcher;
+
+// guards the fields below and wakes the workflow thread
+static std::mutex wake_mutex;
+static std::condition_variable wake_cv;
+static bool engine_stopping = false;
+static bool change_reported = false;
+static std::vector<std::shared_ptr<workflow_state>> workflow_states;
+// finished generations (key, text) to store in the response cache, which writes files and so
+// is only called from the workflow thread
+static std::vector<std::pair<std::string, std::string>> cache_puts;
+
+static bool read_text_source(const std::string &name, std::string &text)
+{
+	obs_source_t *source = obs_get_source_by_name(name.c_str());
+	if (source == nullptr) {
+		return false;
+	}
+	obs_data_t *settings = obs_source_get_settings(source);
+	text = obs_data_get_string(settings, "text");
+	obs_data_release(settings);
+	obs_source_release(source);
+	return true;
+}
+
+static size_t input_max_bytes()
+{
+	return (size_t)std::max(llm_config_snapshot()->workflow_input_max_bytes, 1);
+}
+
+// read the input of a workflow, false if there is none or it could not be read. file sources
+// only read what is needed: the appended bytes or the end of the file.
+static bool read_input(workflow_state &state, std::string &input)
+{
+	const size_t max_bytes = input_max_bytes();
+	switch (state.wf.source_type) {
+	case WORKFLOW_IO_FILE:
+		return state.wf.source_mode == WORKFLOW_FILE_APPENDED
+			       ? file_read_appended(state.wf.source, state.tail, max_bytes, input)
+			       : file_read_window(state.wf.source, max_bytes, input);
+	case WORKFLOW_IO_TEXT_SOURCE:
+		return read_text_source(state.wf.source, input);
+	default:
+		return false;
+	}
+}
+
+// write a streamed piece, output is all text generated so far. the sinks only buffer it, the
+// source and the file are written by other threads.
+static void write_partial(workflow_state &state, const std::string &piece,
+			  const std::string &output)
+{
+	if (state.text_sink) {
+		state.text_sink->set_text(output);
+	}
+	if (state.file_out) {
+		state.file_out->write(state.wf.target_mode == WORKFLOW_OUTPUT_APPEND ? piece
+										 : output);
+	}
+}
+
+static void write_done(workflow_state &state, const std::string &generation)
+{
+	if (state.text_sink) {
+		state.text_sink->set_text(generation);
+	}
+	if (state.file_out) {
+		if (state.wf.target_mode == WORKFLOW_OUTPUT_REPLACE) {
+			state.file_out->write(generation);
+		} else {
+			// streamed pieces were appended already
+			state.file_out->write(state.wf.streaming ? "\n" : generation + "\n");
+		}
+		state.file_out->commit();
+	}
+}
+
+// whether another workflow may start now
+static bool can_start(const workflow_state &state)
+{
+	return !state.running && llm_background_scheduler() != nullptr &&
+	       n_running < std::max(llm_config_snapshot()->workflow_max_concurrency, 1);
+}
+
+static void start_run(const std::shared_ptr<workflow_state> &state, const std::string &input)
+{
+	const cancellation_token cancel = engine_cancel;
+
+	inference_job job;
+	job.prompt = replace(state->wf.prompt, "{input}", input);
+	// the cache key and the request see the same settings
+	job.config = llm_config_snapshot();
+
+	std::string cache_key;
+	if (job.config->response_cache) {
+		cache_key = response_cache_key(*job.config, job.prompt);
+		std::string cached;
+		const bool hit = response_cache_get(cache_key, cached);
+		inference_metrics_record_cache(hit);
+		if (hit) {
+			// same model, settings and prompt as before: no inference at all
+			if (state->wf.streaming) {
+				write_partial(*state, cached, cached);
+			}
+			write_done(*state, cached);
+			return;
+		}
+	}
+
+	job.priority = INFERENCE_PRIORITY_BACKGROUND;
+	job.cancel = cancel;
+	if (state->wf.streaming && state->wf.target_type != WORKFLOW_IO_NONE) {
+		auto output = std::make_shared<std::string>();
+		job.partial_generation_callback = [state, cancel,
+						   output](const std::string &partial_generation) {
+			*output += partial_generation;
+			if (!*cancel) {
+				write_partial(*state, partial_generation, *output);
+			}
+		};
+	}
+	job.done_callback = [state, cancel, cache_key](const std::string &generation,
+						       inference_stop_reason stop_reason) {
+		// a stopped engine leaves the target as it was
+		if (!*cancel && !generation.empty()) {
+			write_done(*state, generation);
+			// only complete generations, not ones cut short by a limit or an error
+			if (!cache_key.empty() && (stop_reason == INFERENCE_STOP_EOS ||
+						   stop_reason == INFERENCE_STOP_STRING)) {
+				std::lock_guard<std::mutex> lock(wake_mutex);
+				cache_puts.emplace_back(cache_key, generation);
+			}
+		}
+		state->running = false;
+		n_running--;
+	};
+
+	state->running = true;
+	n_running++;
+	llm_background_scheduler()->submit(std::move(job));
+}
+
+static void run_periodic(const std::shared_ptr<workflow_state> &state)
+{
+	if (!can_start(*state)) {
+		obs_log(LOG_DEBUG, "Workflow still running or at the concurrency limit, skipped");
+		return;
+	}
+	std::string input;
+	if (state->wf.source_type != WORKFLOW_IO_NONE && !read_input(*state, input)) {
+		return;
+	}
+	// nothing was appended since the last run
+	if (state->wf.source_type == WORKFLOW_IO_FILE &&
+	    state->wf.source_mode == WORKFLOW_FILE_APPENDED && input.empty()) {
+		return;
+	}
+	start_run(state, input);
+}
+
+// read the input of an on-change workflow and note when it changed
+static void poll_input(workflow_state &state, int64_t now_us)
+{
+	std::string input;
+	if (!read_input(state, input)) {
+		return;
+	}
+	if (state.wf.source_type == WORKFLOW_IO_FILE &&
+	    state.wf.source_mode == WORKFLOW_FILE_APPENDED) {
+		// collect what was appended until the next run
+		state.has_input = true;
+		if (!input.empty()) {
+			state.input += input;
+			text_keep_tail(state.input, input_max_bytes());
+			state.pending = true;
+			state.changed_us = now_us;
+		}
+		return;
+	}
+	if (state.has_input && input == state.input) {
+		return;
+	}
+	// the input found at start is the baseline, only later changes trigger a run
+	if (state.has_input) {
+		state.pending = true;
+		state.changed_us = now_us;
+	}
+	state.input = std::move(input);
+	state.has_input = true;
+}
+
+// file sources are read when the watcher reported a write (input_event), text sources on
+// every poll
+static void run_on_change(const std::shared_ptr<workflow_state> &state, int64_t now_us,
+			  bool input_event)
+{
+	if (input_event || !state->has_input || state->wf.source_type != WORKFLOW_IO_FILE) {
+		poll_input(*state, now_us);
+	}
+	// debounce: wait until the input stopped changing for trigger_ms. while the previous run
+	// is still generating the change stays pending and runs with the latest input afterwards.
+	if (!state->pending || now_us - state->changed_us < (int64_t)state->wf.trigger_ms * 1000 ||
+	    !can_start(*state)) {
+		return;
+	}
+	state->pending = false;
+	start_run(state, state->input);
+	if (state->wf.source_type == WORKFLOW_IO_FILE &&
+	    state->wf.source_mode == WORKFLOW_FILE_APPENDED) {
+		state->input.clear();
+	}
+}
+
+static int poll_interval_ms(const workflow &wf)
+{
+	return std::clamp(wf.trigger_ms, WORKFLOW_TICK_MS, WORKFLOW_POLL_MS);
+}
+
+static void on_timer(timer_wheel &wheel, size_t id)
+{
+	const std::shared_ptr<workflow_state> &state = workflow_states[id];
+	if (state->wf.trigger == WORKFLOW_TRIGGER_PERIODIC) {
+		wheel.schedule(id, std::max(state->wf.trigger_ms, WORKFLOW_MIN_PERIOD_MS));
+		run_periodic(state);
+	} else {
+		wheel.schedule(id, poll_interval_ms(state->wf));
+		run_on_change(state, ggml_time_us(), false);
+	}
+}
+
+static void workflow_thread()
+{
+	const std::chrono::milliseconds tick(WORKFLOW_TICK_MS);
+	timer_wheel wheel;
+	// workflow_states does not change while the thread runs
+	for (size_t i = 0; i < workflow_states.size(); i++) {
+		const workflow &wf = workflow_states[i]->wf;
+		// on-change workflows read their baseline input right away
+		wheel.schedule(i, wf.trigger == WORKFLOW_TRIGGER_PERIODIC
+					  ? std::max(wf.trigger_ms, WORKFLOW_MIN_PERIOD_MS)
+					  : 0);
+	}
+
+	std::vector<size_t> expired;
+	std::vector<std::pair<std::string, std::string>> finished;
+	std::chrono::steady_clock::time_point next_tick = std::chrono::steady_clock::now() + tick;
+	std::unique_lock<std::mutex> lock(wake_mutex);
+	while (true) {
+		wake_cv.wait_until(lock, next_tick,
+				   []() { return engine_stopping || change_reported; });
+		if (engine_stopping) {
+			break;
+		}
+		const bool changed = std::exchange(change_reported, false);
+		finished.swap(cache_puts);
+		lock.unlock();
+
+		for (const std::pair<std::string, std::string> &put : finished) {
+			response_cache_put(put.first, put.second);
+		}
+		finished.clear();
+
+		if (changed) {
+			for (const std::shared_ptr<workflow_state> &state : workflow_states) {
+				if (state->check_now.exchange(false)) {
+					run_on_change(state, ggml_time_us(), true);
+				}
+			}
+		}
+		// catch up on the ticks that passed, e.g. after a late wakeup
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		while (next_tick <= now) {
+			next_tick += tick;
+			wheel.advance(expired);
+		}
+		for (size_t id : expired) {
+			on_timer(wheel, id);
+		}
+		expired.clear();
+		for (const std::shared_ptr<workflow_state> &state : workflow_states) {
+			if (state->text_sink) {
+				state->text_sink->flush(ggml_time_us());
+			}
+		}
+
+		lock.lock();
+	}
+}
+
+void workflow_engine_stop()
+{
+	std::lock_guard<std::mutex> lock(engine_mutex);
+	watcher.reset();
+	{
+		std::lock_guard<std::mutex> wake_lock(wake_mutex);
+		engine_stopping = true;
+	}
+	wake_cv.notify_all();
+	if (engine_thread.joinable()) {
+		engine_thread.join();
+	}
+	if (engine_cancel) {
+		*engine_cancel = true;
+	}
+	std::lock_guard<std::mutex> wake_lock(wake_mutex);
+	// show the last output that was not flushed yet
+	for (const std::shared_ptr<workflow_state> &state : workflow_states) {
+		if (state->text_sink) {
+			state->text_sink->flush(ggml_time_us(), true);
+		}
+	}
+	workflow_states.clear();
+}
+
+void workflow_engine_start()
+{
+	workflow_engine_stop();
+
+	std::vector<std::shared_ptr<workflow_state>> states;
+	for (size_t i = 0; i < global_llm_config.workflows.size(); i++) {
+		auto state = std::make_shared<workflow_state>();
+		if (!workflow_from_json(global_llm_config.workflows[i], state->wf)) {
+			obs_log(LOG_WARNING, "Workflow %d is not valid JSON, skipped", (int)i + 1);
+			continue;
+		}
+		if (!state->wf.local) {
+			obs_log(LOG_WARNING, "Workflow %d runs on the cloud, not supported yet",
+				(int)i + 1);
+			continue;
+		}
+		if (state->wf.trigger == WORKFLOW_TRIGGER_ON_CHANGE &&
+		    state->wf.source_type == WORKFLOW_IO_NONE) {
+			obs_log(LOG_WARNING, "Workflow %d triggers on change but has no input",
+				(int)i + 1);
+			continue;
+		}
+		if (state->wf.source_type == WORKFLOW_IO_FILE &&
+		    state->wf.source_mode == WORKFLOW_FILE_APPENDED) {
+			// start at the current end of the file, or at the start of a file that
+			// does not exist yet
+			std::string ignored;
+			if (!file_read_appended(state->wf.source, state->tail, 0, ignored)) {
+				state->tail.started = true;
+			}
+		}
+		if (state->wf.target_type == WORKFLOW_IO_TEXT_SOURCE) {
+			state->text_sink = std::make_unique<text_source_sink>(state->wf.target);
+		} else if (state->wf.target_type == WORKFLOW_IO_FILE && !state->wf.target.empty()) {
+			state->file_out = std::make_unique<file_sink>(
+				state->wf.target,
+				state->wf.target_mode == WORKFLOW_OUTPUT_APPEND ? FILE_SINK_APPEND
+										: FILE_SINK_REPLACE,
+				(file_sink_sync)std::clamp(global_llm_config.workflow_file_sync,
+							   (int)FILE_SINK_SYNC_NEVER,
+							   (int)FILE_SINK_SYNC_ALWAYS));
+		}
+		states.push_back(std::move(state));
+	}
+	if (states.empty()) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(engine_mutex);
+	{
+		std::lock_guard<std::mutex> wake_lock(wake_mutex);
+		workflow_states = std::move(states);
+		engine_stopping = false;
+		change_reported = false;
+	}
+	engine_cancel = make_cancellation_token();
+	obs_log(LOG_INFO, "Running %d workflows", (int)workflow_states.size());
+	engine_thread = std::thread(workflow_thread);
+
+	// on-change workflows read their files when they were written
+	for (const std::shared_ptr<workflow_state> &state : workflow_states) {
+		if (state->wf.trigger == WORKFLOW_TRIGGER_ON_CHANGE &&
+		    state->wf.source_type == WORKFLOW_IO_FILE) {
+			if (!watcher) {
+				watcher = std::make_unique<file_watcher>(
+					workflow_engine_notify_change);
+			}
+			watcher->add(state->wf.source);
+		}
+	}
+	if (watcher) {
+		watcher->start();
+	}
+}
+
+void workflow_engine_notify_change(const std::string &source)
+{
+	bool found = false;
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		for (const std::shared_ptr<workflow_state> &state : workflow_states) {
+			if (state->wf.trigger == WORKFLOW_TRIGGER_ON_CHANGE &&
+			    state->wf.source == source) {
+				state->check_now = true;
+				found = true;
+			}
+		}
+		change_reported = change_reported || found;
+	}
+	if (found) {
+		wake_cv.notify_all();
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef WORKFLOW_ENGINE_H
+#define WORKFLOW_ENGINE_H
+
+#include <string>
+
+// where a workflow reads its input from or writes its output to
+enum workflow_io_type {
+	WORKFLOW_IO_NONE,
+	WORKFLOW_IO_FILE,
+	// an OBS text source, by name
+	WORKFLOW_IO_TEXT_SOURCE,
+};
+
+// what a workflow reads from a file source
+enum workflow_file_mode {
+	// the text appended since the last run, at most the last workflow_input_max_bytes of it
+	WORKFLOW_FILE_APPENDED,
+	// the last workflow_input_max_bytes of the file
+	WORKFLOW_FILE_WINDOW,
+};
+
+// how a workflow writes to a file target
+enum workflow_output_mode {
+	// replace the file with the latest generation
+	WORKFLOW_OUTPUT_REPLACE,
+	// append every generation as a new line
+	WORKFLOW_OUTPUT_APPEND,
+};
+
+enum workflow_trigger {
+	// run when the input changed and then stayed unchanged for trigger_ms
+	WORKFLOW_TRIGGER_ON_CHANGE,
+	// run every trigger_ms
+	WORKFLOW_TRIGGER_PERIODIC,
+};
+
+// one workflow of the Workflows dialog, parsed from its JSON
+struct workflow {
+	// {input} is replaced with the input
+	std::string prompt;
+	workflow_io_type source_type = WORKFLOW_IO_NONE;
+	// file path or text source name
+	std::string source;
+	workflow_file_mode source_mode = WORKFLOW_FILE_APPENDED;
+	workflow_io_type target_type = WORKFLOW_IO_NONE;
+	// file path or text source name
+	std::string target;
+	workflow_output_mode target_mode = WORKFLOW_OUTPUT_REPLACE;
+	bool local = true;
+	// write the output to the target while it is generated, not only when done
+	bool streaming = false;
+	workflow_trigger trigger = WORKFLOW_TRIGGER_PERIODIC;
+	// period of periodic workflows, debounce time of on-change workflows
+	int trigger_ms = 100;
+};
+
+// parse one entry of llm_config_data::workflows, false if it is not valid JSON
+bool workflow_from_json(const std::string &json, workflow &wf);
+
+// Parse global_llm_config.workflows once and run them on the workflow thread: periodic
+// workflows on a timer wheel, on-change workflows when their input changed. A workflow is
+// skipped while its previous run is still generating, and at most workflow_max_concurrency
+// workflows generate at a time, all as background requests on the shared scheduler.
+// Starting again replaces the running workflows, e.g. after the Workflows dialog saved.
+void workflow_engine_start();
+
+// stop the workflow thread and cancel the running workflows
+void workflow_engine_stop();
+
+// check the on-change workflows reading this file or text source on the next tick instead of
+// waiting for the next poll, may be called from any thread
+void workflow_engine_notify_change(const std::string &source);
+
+#endif // WORKFLOW_ENGINE_H
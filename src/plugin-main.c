@@ -33,5 +33,6 @@ bool obs_module_load(void)
 
 void obs_module_unload(void)
 {
+	unregister_llm_dock();
 	obs_log(LOG_INFO, "plugin unloaded");
 }